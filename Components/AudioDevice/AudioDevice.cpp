@@ -28,16 +28,133 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <AudioDevice.h>
 #include <Constants.h>
+#include <DriftCorrection.h>
+#include <RingBuffer.h>
 
 #include <RtAudio.h>
 
 #include <algorithm>
+#include <cmath>
 #include <condition_variable>
+#include <cstdlib>
 #include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
 
 using namespace DSPatch;
 using namespace DSPatchables;
 
+// Realtime helpers for the audio thread: each returns false where the platform or our permissions don't allow it
+
+static bool set_thread_priority( int priority )
+{
+#ifdef _WIN32
+    (void)priority;
+    return SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL ) != 0;
+#else
+    sched_param param{};
+    param.sched_priority = std::min( std::max( priority, sched_get_priority_min( SCHED_FIFO ) ), sched_get_priority_max( SCHED_FIFO ) );
+    return pthread_setschedparam( pthread_self(), SCHED_FIFO, &param ) == 0;
+#endif
+}
+
+// What an audio thread applies to itself on its first callback. StartStream() prepares these, so that all the
+// callback has left to do is make the scheduling and affinity calls (a fixed-size CPU set: nothing to allocate)
+struct ThreadSettings
+{
+    int priority = 0;  // (0: leave the driver's default)
+    bool pinned = false;
+#if defined( _WIN32 )
+    DWORD_PTR cpus = 0;
+#elif defined( __linux__ )
+    cpu_set_t cpus;
+#endif
+};
+
+static ThreadSettings make_thread_settings( int priority, std::vector<int> const& cpus )
+{
+    ThreadSettings settings;
+    settings.priority = priority;
+#if defined( _WIN32 )
+    for ( auto cpu : cpus )
+    {
+        if ( cpu >= 0 && cpu < (int)sizeof( DWORD_PTR ) * 8 )
+        {
+            settings.cpus |= (DWORD_PTR)1 << cpu;
+        }
+    }
+    settings.pinned = settings.cpus != 0;
+#elif defined( __linux__ )
+    CPU_ZERO( &settings.cpus );
+    for ( auto cpu : cpus )
+    {
+        if ( cpu >= 0 && cpu < CPU_SETSIZE )
+        {
+            CPU_SET( cpu, &settings.cpus );
+        }
+    }
+    settings.pinned = CPU_COUNT( &settings.cpus ) != 0;
+#else
+    (void)cpus;  // (no thread affinity on macOS)
+#endif
+    return settings;
+}
+
+static bool set_thread_affinity( ThreadSettings const& settings )
+{
+    if ( !settings.pinned )
+    {
+        return false;
+    }
+#if defined( _WIN32 )
+    return SetThreadAffinityMask( GetCurrentThread(), settings.cpus ) != 0;
+#elif defined( __linux__ )
+    return pthread_setaffinity_np( pthread_self(), sizeof( settings.cpus ), &settings.cpus ) == 0;
+#else
+    return false;
+#endif
+}
+
+// mlockall() and munlockall() act on the whole process, so memory stays locked while any device holds it
+static std::mutex memoryLockMutex;
+static int memoryLockCount = 0;
+
+static bool lock_memory()
+{
+#ifdef _WIN32
+    return false;
+#else
+    std::lock_guard<std::mutex> lock( memoryLockMutex );
+    if ( memoryLockCount == 0 && mlockall( MCL_CURRENT | MCL_FUTURE ) != 0 )
+    {
+        return false;
+    }
+    ++memoryLockCount;
+    return true;
+#endif
+}
+
+static void unlock_memory()
+{
+#ifndef _WIN32
+    std::lock_guard<std::mutex> lock( memoryLockMutex );
+    if ( memoryLockCount > 0 && --memoryLockCount == 0 )
+    {
+        munlockall();
+    }
+#endif
+}
+
 namespace DSPatch
 {
 namespace DSPatchables
@@ -45,24 +162,271 @@ namespace DSPatchables
 namespace internal
 {
 
+// Lock-free log2 histogram of microsecond durations (see AudioDevice::TimingHistogram)
+class TimingHistogram
+{
+public:
+    void Add( int64_t us )
+    {
+        size_t bucket = 0;
+        while ( bucket < c_timingBucketCount - 1 && us >> bucket != 0 )
+        {
+            ++bucket;
+        }
+
+        buckets[bucket].fetch_add( 1, std::memory_order_relaxed );
+        count.fetch_add( 1, std::memory_order_relaxed );
+        totalUs.fetch_add( us, std::memory_order_relaxed );
+        if ( us > maxUs.load( std::memory_order_relaxed ) )
+        {
+            maxUs.store( us, std::memory_order_relaxed );
+        }
+    }
+
+    void Reset()
+    {
+        for ( auto& bucket : buckets )
+        {
+            bucket = 0;
+        }
+        count = 0;
+        totalUs = 0;
+        maxUs = 0;
+    }
+
+    DSPatchables::AudioDevice::TimingHistogram Get() const
+    {
+        DSPatchables::AudioDevice::TimingHistogram histogram;
+        for ( auto const& bucket : buckets )
+        {
+            histogram.buckets.push_back( bucket );
+        }
+        histogram.count = count;
+        histogram.meanUs = histogram.count != 0 ? totalUs / histogram.count : 0;
+        histogram.maxUs = maxUs;
+        return histogram;
+    }
+
+private:
+    std::atomic<uint64_t> buckets[c_timingBucketCount] = {};
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> totalUs = 0;
+    std::atomic<int64_t> maxUs = 0;
+};
+
+// A device streamed alongside the main one, each direction resampled to the main device's clock through a FIFO
+class AggregateDevice
+{
+public:
+    explicit AggregateDevice( RtAudio::DeviceInfo const& deviceInfo )
+        : deviceInfo( deviceInfo )
+    {
+    }
+
+    bool Start( unsigned int sampleRate, unsigned int bufferSize );
+    void Stop();
+
+    static int StaticCallback(
+        void* outputBuffer, void* inputBuffer, unsigned int nBufferFrames, double streamTime, unsigned int status, void* userData );
+
+    // Resample between the device's native format and the main device's clock (see AudioDevice::WriteOutput())
+    void Playback( void* out, unsigned int frameCount, int64_t nowNs );
+    void Capture( void const* in, unsigned int frameCount, int64_t nowNs );
+
+    template <typename Sample, typename Converter>
+    void Playback( Sample* out, unsigned int frameCount, int64_t nowNs, Converter convert );
+
+    template <typename Sample, typename Converter>
+    void Capture( Sample const* in, unsigned int frameCount, int64_t nowNs, Converter convert );
+
+    // Process_() moves whole blocks in and out of the FIFOs. Interpolate the fill across the current block
+    // period so that the controllers see a smooth level rather than a staircase that beats against our period.
+    double BlockProgress( int64_t nowNs ) const
+    {
+        auto elapsed = (double)( nowNs - lastProcessNs.load( std::memory_order_relaxed ) ) / blockNs;
+        return std::min( std::max( elapsed, 0.0 ), 1.0 );
+    }
+
+    static int64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+    RtAudio::DeviceInfo deviceInfo;
+    RtAudio audioStream;
+
+    unsigned int outputCount = 0;
+    unsigned int inputCount = 0;
+    unsigned int blockSize = 0;  // (the main device's)
+    RtAudioFormat streamFormat = RTAUDIO_SINT16;
+    bool running = false;        // (false if the stream failed to start: the channels then stay silent)
+
+    ThreadSettings threadSettings;  // (the main device's, applied on the first callback)
+    std::atomic<bool> realtimePending = false;
+    double blockNs = 1.0;
+    size_t targetFrames = 0;
+    std::atomic<int64_t> lastProcessNs = 0;  // when Process_() last traded a block
+
+    // playback: Process_() writes the main device's blocks, the callback reads them at its own pace
+    SampleFifo outputFifo;
+    DriftController outputDrift;
+    std::vector<float> outputPrev;
+    std::vector<float> outputNext;
+    std::vector<short> outputFrame;
+    double outputPhase = 1.0;
+    bool outputPrimed = false;
+
+    // capture: the callback writes resampled frames, Process_() reads them in the main device's blocks
+    SampleFifo inputFifo;
+    DriftController inputDrift;
+    std::vector<float> inputPrev;
+    std::vector<float> inputNext;
+    std::vector<short> inputFrame;
+    double inputPhase = 0.0;
+    bool inputPrimed = false;
+
+    std::vector<short> processScratch;  // (Process_() only)
+
+    std::atomic<uint64_t> underrunCount = 0;
+    std::atomic<uint64_t> overrunCount = 0;
+};
+
+// The blocks queued between Process_() and the callback, all of one (graph) block size. A live buffer size change
+// stages a second set, and each side moves over to it at a block boundary once the other has (see SwitchBufferSize())
+struct BlockQueues
+{
+    BlockQueues( unsigned int blockSize, size_t blockCount, unsigned int outputChannelCount, unsigned int inputChannelCount )
+        : blockSize( blockSize )
+        , outputRing( blockCount )
+        , inputRing( blockCount )
+        , silence( inputChannelCount, std::vector<short>( blockSize, 0 ) )
+    {
+        for ( auto& block : outputRing.Slots() )
+        {
+            block.assign( outputChannelCount, std::vector<short>( blockSize, 0 ) );
+        }
+        for ( auto& block : inputRing.Slots() )
+        {
+            block.assign( inputChannelCount, std::vector<short>( blockSize, 0 ) );
+        }
+    }
+
+    // frames queued for the callback to play, and room left for it to capture into
+    // (exact on the callback thread, a close estimate elsewhere)
+    size_t OutputFrames() const
+    {
+        const size_t pos = outputBlockPos.load( std::memory_order_relaxed );
+        const size_t frames = outputRing.Size() * blockSize;
+        return frames > pos ? frames - pos : 0;
+    }
+
+    size_t InputRoom() const
+    {
+        const size_t pos = inputBlockPos.load( std::memory_order_relaxed );
+        const size_t room = ( inputRing.Capacity() - inputRing.Size() ) * blockSize;
+        return room > pos ? room - pos : 0;
+    }
+
+    const unsigned int blockSize;
+    RingBuffer<std::vector<std::vector<short>>> outputRing;
+    RingBuffer<std::vector<std::vector<short>>> inputRing;
+    std::vector<std::vector<short>> silence;  // (for when no input block is ready)
+
+    // the callback's position within the blocks at the front of each ring (written by the callback only)
+    std::atomic<size_t> outputBlockPos = 0;
+    std::atomic<size_t> inputBlockPos = 0;
+};
+
 class AudioDevice
 {
 public:
     AudioDevice()
     {
-        deviceList = audioStream.getDeviceIds();
+        LoadDevices();
+    }
+
+    bool LoadDevices();
+    RtAudio::DeviceInfo GetDeviceInfo( unsigned int deviceId ) const;
+
+    unsigned int AggregateOutputCount() const
+    {
+        unsigned int count = 0;
+        for ( auto const& aggregate : aggregates )
+        {
+            count += aggregate->outputCount;
+        }
+        return count;
+    }
+
+    unsigned int AggregateInputCount() const
+    {
+        unsigned int count = 0;
+        for ( auto const& aggregate : aggregates )
+        {
+            count += aggregate->inputCount;
+        }
+        return count;
     }
 
-    void WaitForBuffer();
-    void SyncBuffer();
+    static bool SameDeviceInfo( RtAudio::DeviceInfo const& a, RtAudio::DeviceInfo const& b )
+    {
+        return a.ID == b.ID && a.name == b.name && a.outputChannels == b.outputChannels && a.inputChannels == b.inputChannels &&
+               a.duplexChannels == b.duplexChannels && a.isDefaultOutput == b.isDefaultOutput && a.isDefaultInput == b.isDefaultInput &&
+               a.sampleRates == b.sampleRates && a.preferredSampleRate == b.preferredSampleRate && a.nativeFormats == b.nativeFormats;
+    }
 
     void StopStream();
     void StartStream();
 
+    // Live reconfiguration: each prepares the change alongside the running stream and switches over without stopping it
+    // (false if the change can't be made live, in which case the caller restarts the stream instead)
+    bool SwitchBufferSize( unsigned int newBufferSize );
+    bool SwitchSampleRate( unsigned int newSampleRate );
+    bool SettleQueues();
+    void StageQueues( unsigned int newBufferSize, unsigned int newPeriodSize );
+
+    void RunClock();
+
     static int StaticCallback(
         void* outputBuffer, void* inputBuffer, unsigned int nBufferFrames, double streamTime, unsigned int status, void* userData );
 
-    int DynamicCallback( void* inputBuffer, void* outputBuffer, RtAudioStreamStatus status );
+    int StreamCallback( int slot, void* inputBuffer, void* outputBuffer, unsigned int frameCount, RtAudioStreamStatus status );
+    int DynamicCallback( void* inputBuffer, void* outputBuffer, unsigned int frameCount, RtAudioStreamStatus status );
+    void ApplyRealtimeOptions();
+
+    // Convert frames [offset, offset + count) of a block to and from the device's interleaved native format in a single pass
+    void WriteOutput( std::vector<std::vector<short>> const& block, size_t offset, size_t count, void* outputBuffer );
+    void ReadInput( void const* inputBuffer, std::vector<std::vector<short>>& block, size_t offset, size_t count );
+
+    template <typename Sample, typename Converter>
+    static void Interleave( std::vector<std::vector<short>> const& block, size_t offset, size_t count, Sample* out, Converter convert );
+
+    template <typename Sample, typename Converter>
+    static void Deinterleave( Sample const* in, std::vector<std::vector<short>>& block, size_t offset, size_t count, Converter convert );
+
+    // Fade the first (fadeIn) or last c_crossfadeFrames of a period of output, either side of a stream handoff
+    void FadeOutput( void* outputBuffer, size_t frameCount, bool fadeIn );
+
+    template <typename Sample>
+    static void Fade( Sample* buffer, size_t frameCount, size_t channelCount, bool fadeIn );
+
+    static RtAudioFormat NegotiateFormat( RtAudioFormat nativeFormats )
+    {
+        // Prefer a format the device handles natively so that RtAudio passes our buffers straight through
+        for ( auto format : { RTAUDIO_SINT16, RTAUDIO_SINT32, RTAUDIO_FLOAT32, RTAUDIO_FLOAT64 } )
+        {
+            if ( nativeFormats & format )
+            {
+                return format;
+            }
+        }
+        return RTAUDIO_SINT16;  // (RtAudio converts)
+    }
+
+    static size_t FormatBytes( RtAudioFormat format )
+    {
+        return format == RTAUDIO_FLOAT64 ? 8 : format == RTAUDIO_SINT32 || format == RTAUDIO_FLOAT32 ? 4 : 2;
+    }
 
     static void SanitizeDeviceName( std::string& name )
     {
@@ -73,28 +437,101 @@ public:
             name.begin(), name.end(), []( char c ) { return !std::isprint( static_cast<unsigned char>( c ) ); }, '_' );
     }
 
-    std::vector<std::vector<short>> outputChannels;
-    std::vector<std::vector<short>> inputChannels;
+    // blocks of channel buffers queued between Process_() and the sound card
+    std::unique_ptr<BlockQueues> queues;
+    std::unique_ptr<BlockQueues> stagedQueues;        // (while a live buffer size change is under way)
+    std::atomic<BlockQueues*> nextQueues = nullptr;  // the staged queues, once ready for each side to move to
+    std::atomic<BlockQueues*> processOutput = nullptr;   // (written by Process_() only)
+    std::atomic<BlockQueues*> processInput = nullptr;    // (written by Process_() only)
+    std::atomic<BlockQueues*> processSettled = nullptr;  // (written by Process_() only)
+    std::atomic<BlockQueues*> callbackOutput = nullptr;  // (written by the callback only)
+    std::atomic<BlockQueues*> callbackInput = nullptr;   // (written by the callback only)
+    size_t bufferDepth = c_bufferDepth;
 
-    std::mutex buffersMutex;
     std::mutex syncMutex;
-    std::condition_variable waitCondt;
     std::condition_variable syncCondt;
-    bool gotWaitReady = false;
-    bool gotSyncReady = true;
 
-    unsigned int currentDeviceId = 0;
-    bool isStreaming = false;
-    unsigned int bufferSize = c_bufferSize;
-    unsigned int sampleRate = c_sampleRate;
+    std::atomic<uint64_t> underrunCount = 0;
+    std::atomic<uint64_t> overrunCount = 0;
+
+    // longest gap seen between consecutive Process_() calls (the ring must hold enough blocks to bridge it)
+    std::chrono::steady_clock::time_point lastProcessTime;
+    std::atomic<int64_t> maxProcessIntervalUs = 0;
+
+    // timing instrumentation
+    TimingHistogram callbackJitter;
+    TimingHistogram callbackDuration;
+    TimingHistogram processWait;
+    std::atomic<uint64_t> processTimeouts = 0;
+    std::atomic<uint64_t> inputOverflows = 0;
+    std::atomic<uint64_t> outputUnderflows = 0;
+    std::chrono::steady_clock::time_point lastCallbackTime;  // (callback thread only)
+
+    // realtime options: StartStream() locks memory and prepares the thread settings, which each audio thread (ours
+    // and the aggregates') then applies to itself on its first callback
+    DSPatchables::AudioDevice::RealtimeOptions realtimeOptions;
+    DSPatchables::AudioDevice::RealtimeOptions realtimeStatus;  // (what StartStream() set out to apply)
+    mutable std::mutex realtimeMutex;
+    ThreadSettings threadSettings;
+    std::atomic<bool> priorityApplied = false;
+    std::atomic<bool> affinityApplied = false;
+    std::atomic<bool> realtimePending = false;
+    std::atomic<bool> realtimeReport = false;
+    bool memoryLocked = false;
+
+    std::thread dumpThread;
+    std::mutex dumpMutex;
+    std::condition_variable dumpCondt;
+    int dumpIntervalMs = 0;
 
+    unsigned int currentDeviceId = 0;
+    std::atomic<bool> isStreaming = false;
+    std::atomic<unsigned int> bufferSize = c_bufferSize;  // (the graph's block size)
+    unsigned int periodSize = c_bufferSize;               // (the driver's, as granted)
+    unsigned int requestedPeriodSize = 0;                 // (0: same as bufferSize)
+    std::atomic<unsigned int> sampleRate = c_sampleRate;
+    RtAudioFormat streamFormat = RTAUDIO_SINT16;
+
+    // snapshot of every device's info, taken by LoadDevices() so that lookups never go back to the driver
+    // (RtAudio's own device list isn't thread safe, so probing it and opening the stream take probeMutex)
+    std::mutex probeMutex;
+    mutable std::mutex devicesMutex;
     std::vector<unsigned int> deviceList;
+    std::vector<RtAudio::DeviceInfo> deviceInfos;
     RtAudio::DeviceInfo currentDevice;
 
     RtAudio audioStream;
     RtAudio::StreamParameters outputParams;
     RtAudio::StreamParameters inputParams;
 
+    // live sample rate changes open a second stream on the device and hand the rings over to it between periods
+    struct StreamSlot
+    {
+        AudioDevice* device;
+        int index;
+    };
+
+    RtAudio& Stream( int slot )
+    {
+        return slot == 0 ? audioStream : standbyStream;
+    }
+
+    RtAudio standbyStream;
+    StreamSlot streamSlots[2] = { { this, 0 }, { this, 1 } };
+    std::atomic<int> activeSlot = 0;     // the stream whose callback trades with Process_()
+    std::atomic<int> handoffSlot = -1;   // the stream the active one should hand over to (-1: none)
+    bool crossfadeIn = false;            // (callback threads only, ordered by activeSlot)
+
+    // aggregate mode: further devices streamed in step with this one
+    std::vector<std::unique_ptr<AggregateDevice>> aggregates;
+
+    // offline mode: an internal clock thread drives the callback in place of the sound card
+    std::atomic<bool> offline = false;
+    bool paced = true;
+    std::thread clockThread;
+    std::vector<short> offlineOutput;
+    std::vector<short> offlineInput;
+
     std::mutex availableMutex;
     std::mutex processMutex;
     bool isInputDevice = false;
@@ -104,20 +541,113 @@ public:
     bool notFoundNotified = false;
 
     std::function<void( bool )> callback = []( bool ) {};
+
+    // device enumeration happens on a monitor thread, never on the Process_() thread. Any device change it finds
+    // is posted here and applied by Process_() between ticks, so that streams and buses only change on the
+    // graph's thread (or the caller's)
+    std::atomic<bool> deviceAvailable = true;
+    std::function<void()> pendingChange;  // (guarded by availableMutex)
+    std::atomic<bool> changePending = false;
+    std::thread monitorThread;
+    std::mutex monitorMutex;
+    std::condition_variable monitorCondt;
+    bool monitorStop = false;
+    bool checkRequested = false;
 };
 
 }  // namespace internal
 }  // namespace DSPatchables
 }  // namespace DSPatch
 
+static void PrintRealtimeStatus( AudioDevice::RealtimeOptions const& requested, AudioDevice::RealtimeOptions const& applied )
+{
+    std::stringstream log;
+    log << "AudioDevice realtime:";
+    if ( requested.priority > 0 )
+    {
+        log << " priority " << requested.priority << ( applied.priority > 0 ? " applied," : " not applied," );
+    }
+    if ( !requested.cpus.empty() )
+    {
+        log << " cpu affinity" << ( !applied.cpus.empty() ? " applied," : " not applied," );
+    }
+    if ( requested.lockMemory )
+    {
+        log << " memory lock" << ( applied.lockMemory ? " applied," : " not applied," );
+    }
+    auto str = log.str();
+    str.pop_back();
+    std::cout << str << std::endl;
+}
+
+static void PrintTimingStats( AudioDevice::TimingStats const& stats )
+{
+    auto print = []( char const* name, AudioDevice::TimingHistogram const& histogram ) {
+        std::stringstream log;
+        log << "AudioDevice " << name << ": count=" << histogram.count << " mean=" << histogram.meanUs
+            << "us max=" << histogram.maxUs << "us";
+        for ( size_t i = 0; i < histogram.buckets.size(); ++i )
+        {
+            if ( histogram.buckets[i] != 0 )
+            {
+                log << " <" << ( 1ull << i ) << "us:" << histogram.buckets[i];
+            }
+        }
+        std::cout << log.str() << std::endl;
+    };
+
+    print( "callback jitter", stats.callbackJitter );
+    print( "callback duration", stats.callbackDuration );
+    print( "process wait", stats.processWait );
+    std::cout << "AudioDevice process timeouts: " << stats.processTimeouts << ", driver input overflows: " << stats.inputOverflows
+              << ", driver output underflows: " << stats.outputUnderflows << std::endl;
+}
+
 AudioDevice::AudioDevice( bool isOutputDevice, std::vector<std::string> const& deviceNameHas, bool defaultIfNotFound, bool loopback )
     : p( new internal::AudioDevice() )
 {
     SetDevice( isOutputDevice, deviceNameHas, defaultIfNotFound, loopback );
+
+    p->monitorThread = std::thread( [this]() {
+        std::unique_lock<std::mutex> lock( p->monitorMutex );
+        while ( !p->monitorStop )
+        {
+            // look for changes periodically, or straight away when Process_() times out waiting on the device
+            p->monitorCondt.wait_for( lock, std::chrono::milliseconds( c_deviceMonitorIntervalMs ) );
+            if ( p->monitorStop )
+            {
+                break;
+            }
+
+            bool checkRequested = p->checkRequested;
+            p->checkRequested = false;
+            lock.unlock();
+
+            if ( !Available_( true ) && checkRequested && IsStreaming() )
+            {
+                std::cout << p->currentDevice.name << " disconnected." << std::endl;
+            }
+
+            if ( p->realtimeReport.exchange( false ) )
+            {
+                PrintRealtimeStatus( GetRealtimeOptions(), GetRealtimeStatus() );
+            }
+
+            lock.lock();
+        }
+    } );
 }
 
 AudioDevice::~AudioDevice()
 {
+    {
+        std::lock_guard<std::mutex> lock( p->monitorMutex );
+        p->monitorStop = true;
+        p->monitorCondt.notify_all();
+    }
+    p->monitorThread.join();
+
+    SetTimingDumpInterval( 0 );
     p->StopStream();
 }
 
@@ -128,18 +658,46 @@ void AudioDevice::SetAvailableCallback( std::function<void( bool )> const& callb
 }
 
 bool AudioDevice::Available()
+{
+    return Available_( false );
+}
+
+bool AudioDevice::Available_( bool deferChange )
 {
     std::lock_guard<std::mutex> lock( p->availableMutex );
 
+    // make device changes here, or (from the monitor thread) leave them to Process_(). Each pass decides afresh, and a
+    // change only counts as notified once it has been applied, so one Process_() hasn't got to yet is simply posted again
+    p->pendingChange = nullptr;
+    p->changePending = false;
+    auto change = [this, deferChange]( std::function<void()> apply ) {
+        if ( deferChange )
+        {
+            p->pendingChange = std::move( apply );
+            p->changePending = true;
+        }
+        else
+        {
+            apply();
+        }
+    };
+
+    if ( p->offline )
+    {
+        p->deviceAvailable = true;
+        return true;
+    }
+
     if ( p->nameHas.empty() )
     {
         p->notFoundNotified = false;
+        p->deviceAvailable = true;
         return true;
     }
 
     ReloadDevices();
 
-    for ( const auto id : p->deviceList )
+    for ( const auto id : GetDeviceIds() )
     {
         auto name = GetDeviceName( id );
 
@@ -167,10 +725,13 @@ bool AudioDevice::Available()
             }
             else if ( p->currentDevice.name != GetDeviceName( id ) )
             {
-                SetDevice( id, p->loopback );
-                p->callback( true );
+                change( [this, id]() {
+                    SetDevice( id, p->loopback );
+                    p->callback( true );
+                } );
             }
             p->notFoundNotified = false;
+            p->deviceAvailable = true;
             return true;
         }
     }
@@ -182,17 +743,18 @@ bool AudioDevice::Available()
             auto defaultInputDevice = GetDefaultInputDevice();
             if ( GetCurrentDevice() != defaultInputDevice )
             {
-                p->notFoundNotified = true;
-
                 std::stringstream log;
                 for ( auto const& sub : p->nameHas )
                 {
                     log << sub << " ";
                 }
                 log << "input device not found. Switching to default input device: " << GetDeviceName( defaultInputDevice );
-                std::cout << log.str() << std::endl;
 
-                SetDevice( defaultInputDevice, p->loopback );
+                change( [this, defaultInputDevice, message = log.str()]() {
+                    p->notFoundNotified = true;
+                    std::cout << message << std::endl;
+                    SetDevice( defaultInputDevice, p->loopback );
+                } );
             }
         }
         else if ( !p->isInputDevice && !p->notFoundNotified )
@@ -200,38 +762,43 @@ bool AudioDevice::Available()
             auto defaultOutputDevice = GetDefaultOutputDevice();
             if ( GetCurrentDevice() != defaultOutputDevice )
             {
-                p->notFoundNotified = true;
-
                 std::stringstream log;
                 for ( auto const& sub : p->nameHas )
                 {
                     log << sub << " ";
                 }
                 log << "output device not found. Switching to default output device: " << GetDeviceName( defaultOutputDevice );
-                std::cout << log.str() << std::endl;
 
-                SetDevice( defaultOutputDevice, p->loopback );
+                change( [this, defaultOutputDevice, message = log.str()]() {
+                    p->notFoundNotified = true;
+                    std::cout << message << std::endl;
+                    SetDevice( defaultOutputDevice, p->loopback );
+                } );
             }
         }
+        p->deviceAvailable = true;
         return true;
     }
 
     if ( !p->notFoundNotified )
     {
-        p->notFoundNotified = true;
-
         std::stringstream log;
         for ( auto const& sub : p->nameHas )
         {
             log << sub << " ";
         }
         log << ( p->isInputDevice ? "input device" : "output device" ) << " not found.";
-        std::cout << log.str() << std::endl;
 
-        SetDevice( 0, false );
-        p->callback( false );
+        change( [this, message = log.str()]() {
+            p->notFoundNotified = true;
+            std::cout << message << std::endl;
+            SetDevice( 0, false );
+            p->callback( false );
+        } );
     }
 
+    p->deviceAvailable = false;
+
     return false;
 }
 
@@ -240,14 +807,16 @@ bool AudioDevice::SetDevice( unsigned int deviceId, bool loopback )
     if ( deviceId == 0 )
     {
         p->StopStream();
+        p->offline = false;
         p->currentDeviceId = deviceId;
         p->currentDevice = RtAudio::DeviceInfo();
 
         return true;
     }
-    else if ( std::find( p->deviceList.begin(), p->deviceList.end(), deviceId ) != p->deviceList.end() )
+    auto deviceInfo = p->GetDeviceInfo( deviceId );
+    if ( deviceInfo.ID == deviceId && !deviceInfo.sampleRates.empty() )
     {
-        auto sampleRates = p->audioStream.getDeviceInfo( deviceId ).sampleRates;
+        auto const& sampleRates = deviceInfo.sampleRates;
         if ( std::find( sampleRates.begin(), sampleRates.end(), p->sampleRate ) == sampleRates.end() )
         {
             std::cout << "Sample rate " << std::to_string( p->sampleRate ) << " not supported. Switching to "
@@ -255,20 +824,19 @@ bool AudioDevice::SetDevice( unsigned int deviceId, bool loopback )
             p->sampleRate = sampleRates.back();
         }
 
-        std::cout << "Initialising " << GetDeviceName( deviceId ) << std::endl;
+        std::cout << "Initialising " << deviceInfo.name << std::endl;
 
         p->StopStream();
+        p->offline = false;
 
         p->currentDeviceId = deviceId;
-        p->currentDevice = p->audioStream.getDeviceInfo( deviceId );
-        p->SanitizeDeviceName( p->currentDevice.name );
+        p->currentDevice = deviceInfo;
 
         // configure outputParams
         p->outputParams.nChannels = p->currentDevice.outputChannels;
         p->outputParams.deviceId = deviceId;
 
-        p->outputChannels.resize( p->outputParams.nChannels );
-        SetInputCount_( p->outputParams.nChannels );
+        SetInputCount_( p->outputParams.nChannels + p->AggregateOutputCount() );
 
         // configure inputParams
         if ( loopback )
@@ -276,16 +844,14 @@ bool AudioDevice::SetDevice( unsigned int deviceId, bool loopback )
             p->inputParams.nChannels = p->currentDevice.outputChannels;
             p->inputParams.deviceId = deviceId;
 
-            p->inputChannels.resize( p->inputParams.nChannels );
-            SetOutputCount_( p->inputParams.nChannels );
+            SetOutputCount_( p->inputParams.nChannels + p->AggregateInputCount() );
         }
         else
         {
             p->inputParams.nChannels = p->currentDevice.inputChannels;
             p->inputParams.deviceId = deviceId;
 
-            p->inputChannels.resize( p->inputParams.nChannels );
-            SetOutputCount_( p->inputParams.nChannels );
+            SetOutputCount_( p->inputParams.nChannels + p->AggregateInputCount() );
         }
 
         // the stream is started again via SetBufferSize()
@@ -303,13 +869,14 @@ bool AudioDevice::SetDevice( bool isOutputDevice, std::vector<std::string> const
         std::lock_guard<std::mutex> processLock( p->processMutex );
         std::lock_guard<std::mutex> availableLock( p->availableMutex );
 
-        if ( p->isInputDevice == !isOutputDevice && p->nameHas == deviceNameHas && p->defaultIfNotFound == defaultIfNotFound &&
-             p->loopback == loopback )
+        if ( !p->offline && p->isInputDevice == !isOutputDevice && p->nameHas == deviceNameHas &&
+             p->defaultIfNotFound == defaultIfNotFound && p->loopback == loopback )
         {
             // Device already set, don't re-set unneccesarily
             return true;
         }
 
+        p->offline = false;
         p->isInputDevice = !isOutputDevice;
         p->defaultIfNotFound = defaultIfNotFound;
         p->loopback = loopback;
@@ -334,100 +901,251 @@ bool AudioDevice::SetDevice( bool isOutputDevice, std::vector<std::string> const
     return Available();
 }
 
-bool AudioDevice::ReloadDevices()
+void AudioDevice::SetOfflineDevice( unsigned int inputCount, unsigned int outputCount, bool paced )
+{
+    p->StopStream();
+
+    p->offline = true;
+    p->paced = paced;
+
+    p->currentDeviceId = 0;
+    p->currentDevice = RtAudio::DeviceInfo();
+    p->currentDevice.name = "Offline";
+    p->currentDevice.outputChannels = outputCount;
+    p->currentDevice.inputChannels = inputCount;
+
+    p->outputParams.nChannels = outputCount;
+    p->outputParams.deviceId = 0;
+    SetInputCount_( outputCount + p->AggregateOutputCount() );
+
+    p->inputParams.nChannels = inputCount;
+    p->inputParams.deviceId = 0;
+    SetOutputCount_( inputCount + p->AggregateInputCount() );
+
+    // the stream is started again via SetBufferSize()
+    SetBufferSize( GetBufferSize() );
+}
+
+bool AudioDevice::IsOffline() const
+{
+    return p->offline;
+}
+
+bool AudioDevice::AddAggregateDevice( unsigned int deviceId )
 {
-    auto newDeviceList = p->audioStream.getDeviceIds();
+    auto deviceInfo = p->GetDeviceInfo( deviceId );
+    if ( deviceInfo.ID != deviceId || deviceId == 0 || deviceId == p->currentDeviceId ||
+         std::find( deviceInfo.sampleRates.begin(), deviceInfo.sampleRates.end(), p->sampleRate ) == deviceInfo.sampleRates.end() )
+    {
+        return false;
+    }
 
-    bool devicesChanged = false;
-    for ( size_t i = 0; i < newDeviceList.size(); ++i )
+    for ( auto const& aggregate : p->aggregates )
     {
-        if ( i >= p->deviceList.size() || newDeviceList[i] != p->deviceList[i] )
+        if ( aggregate->deviceInfo.ID == deviceId )
         {
-            devicesChanged = true;
-            break;
+            return false;
         }
     }
 
-    if ( devicesChanged )
+    std::cout << "Aggregating " << deviceInfo.name << std::endl;
+
+    p->StopStream();
+    p->aggregates.emplace_back( new internal::AggregateDevice( deviceInfo ) );
+
+    SetInputCount_( p->outputParams.nChannels + p->AggregateOutputCount() );
+    SetOutputCount_( p->inputParams.nChannels + p->AggregateInputCount() );
+
+    // the stream is started again via SetBufferSize()
+    SetBufferSize( GetBufferSize() );
+    return true;
+}
+
+void AudioDevice::ClearAggregateDevices()
+{
+    p->StopStream();
+    p->aggregates.clear();
+
+    SetInputCount_( p->outputParams.nChannels );
+    SetOutputCount_( p->inputParams.nChannels );
+
+    if ( p->currentDeviceId != 0 || p->offline )
     {
-        p->deviceList = newDeviceList;
-        return true;
+        p->StartStream();
     }
+}
 
-    return false;
+std::vector<unsigned int> AudioDevice::GetAggregateDevices() const
+{
+    std::vector<unsigned int> deviceIds;
+    for ( auto const& aggregate : p->aggregates )
+    {
+        deviceIds.push_back( aggregate->deviceInfo.ID );
+    }
+    return deviceIds;
+}
+
+std::vector<double> AudioDevice::GetAggregateRatios() const
+{
+    // (both directions track the same pair of clocks, so report whichever is running)
+    std::vector<double> ratios;
+    for ( auto const& aggregate : p->aggregates )
+    {
+        ratios.push_back( aggregate->outputCount != 0 ? aggregate->outputDrift.ratio : aggregate->inputDrift.ratio );
+    }
+    return ratios;
+}
+
+bool AudioDevice::ReloadDevices()
+{
+    return p->LoadDevices();
 }
 
 std::string AudioDevice::GetDeviceName( unsigned int deviceId ) const
 {
-    auto deviceName = p->audioStream.getDeviceInfo( deviceId ).name;
-    p->SanitizeDeviceName( deviceName );
-    return deviceName;
+    return p->GetDeviceInfo( deviceId ).name;
 }
 
 unsigned int AudioDevice::GetDeviceInputCount( unsigned int deviceId ) const
 {
-    return p->audioStream.getDeviceInfo( deviceId ).inputChannels;
+    return p->GetDeviceInfo( deviceId ).inputChannels;
 }
 
 unsigned int AudioDevice::GetDeviceOutputCount( unsigned int deviceId ) const
 {
-    return p->audioStream.getDeviceInfo( deviceId ).outputChannels;
+    return p->GetDeviceInfo( deviceId ).outputChannels;
 }
 
 std::vector<unsigned int> AudioDevice::GetSampleRates( unsigned int deviceId ) const
 {
-    return p->audioStream.getDeviceInfo( deviceId ).sampleRates;
+    return p->GetDeviceInfo( deviceId ).sampleRates;
 }
 
 std::vector<unsigned int> AudioDevice::GetDeviceIds() const
 {
+    std::lock_guard<std::mutex> lock( p->devicesMutex );
     return p->deviceList;
 }
 
 unsigned int AudioDevice::GetDefaultInputDevice() const
 {
-    return p->audioStream.getDefaultInputDevice();
-}
+    std::lock_guard<std::mutex> lock( p->devicesMutex );
 
-unsigned int AudioDevice::GetDefaultOutputDevice() const
-{
-    return p->audioStream.getDefaultOutputDevice();
+    // (as RtAudio does: fall back to the first device with inputs)
+    for ( auto const& deviceInfo : p->deviceInfos )
+    {
+        if ( deviceInfo.isDefaultInput )
+        {
+            return deviceInfo.ID;
+        }
+    }
+    for ( auto const& deviceInfo : p->deviceInfos )
+    {
+        if ( deviceInfo.inputChannels > 0 )
+        {
+            return deviceInfo.ID;
+        }
+    }
+    return 0;
 }
 
-unsigned int AudioDevice::GetCurrentDevice() const
+unsigned int AudioDevice::GetDefaultOutputDevice() const
 {
-    return p->currentDeviceId;
-}
+    std::lock_guard<std::mutex> lock( p->devicesMutex );
 
-unsigned int AudioDevice::SetBufferSize( unsigned int bufferSize )
-{
-    p->StopStream();
-
-    p->bufferSize = bufferSize;
-    for ( auto& inputChannel : p->inputChannels )
+    // (as RtAudio does: fall back to the first device with outputs)
+    for ( auto const& deviceInfo : p->deviceInfos )
+    {
+        if ( deviceInfo.isDefaultOutput )
+        {
+            return deviceInfo.ID;
+        }
+    }
+    for ( auto const& deviceInfo : p->deviceInfos )
     {
-        inputChannel.resize( bufferSize );
+        if ( deviceInfo.outputChannels > 0 )
+        {
+            return deviceInfo.ID;
+        }
     }
+    return 0;
+}
+
+unsigned int AudioDevice::GetCurrentDevice() const
+{
+    return p->currentDeviceId;
+}
+
+unsigned int AudioDevice::SetBufferSize( unsigned int bufferSize )
+{
+    // switch live where possible, otherwise (or when the stream is stopped) start afresh
+    if ( !p->SwitchBufferSize( bufferSize ) )
+    {
+        p->StopStream();
 
-    p->StartStream();
+        p->bufferSize = bufferSize;
+
+        p->StartStream();
+    }
     return p->bufferSize;
 }
 
 bool AudioDevice::SetSampleRate( unsigned int sampleRate )
 {
-    if ( std::find( p->currentDevice.sampleRates.begin(), p->currentDevice.sampleRates.end(), sampleRate ) ==
+    if ( !p->offline && std::find( p->currentDevice.sampleRates.begin(), p->currentDevice.sampleRates.end(), sampleRate ) ==
          p->currentDevice.sampleRates.end() )
     {
         return false;
     }
 
+    // switch live where possible, otherwise (or when the stream is stopped) start afresh
+    if ( !p->SwitchSampleRate( sampleRate ) )
+    {
+        p->StopStream();
+        p->sampleRate = sampleRate;
+        p->StartStream();
+    }
+
+    return true;
+}
+
+bool AudioDevice::SetBufferDepth( unsigned int bufferDepth )
+{
+    if ( bufferDepth < 1 || bufferDepth > c_maxBufferDepth )
+    {
+        return false;
+    }
+
     p->StopStream();
-    p->sampleRate = sampleRate;
-    p->StartStream();
+    p->bufferDepth = bufferDepth;
+    if ( p->currentDeviceId != 0 || p->offline )
+    {
+        p->StartStream();
+    }
 
     return true;
 }
 
+unsigned int AudioDevice::GetBufferDepth() const
+{
+    return (unsigned int)p->bufferDepth;
+}
+
+unsigned int AudioDevice::GetRecommendedBufferDepth() const
+{
+    // enough periods to cover the longest stall seen between Process_() calls
+    const double periodUs = p->periodSize * 1000000.0 / p->sampleRate;  // (bufferDepth counts driver periods)
+    auto depth = (unsigned int)std::ceil( p->maxProcessIntervalUs / periodUs );
+    return std::min( std::max( depth, 1u ), c_maxBufferDepth );
+}
+
+void AudioDevice::ResetBufferStats()
+{
+    p->underrunCount = 0;
+    p->overrunCount = 0;
+    p->maxProcessIntervalUs = 0;
+}
+
 bool AudioDevice::IsStreaming() const
 {
     return p->isStreaming;
@@ -438,11 +1156,126 @@ unsigned int AudioDevice::GetBufferSize() const
     return p->bufferSize;
 }
 
+unsigned int AudioDevice::SetPeriodSize( unsigned int periodSize )
+{
+    p->StopStream();
+
+    p->requestedPeriodSize = periodSize;
+    if ( p->currentDeviceId != 0 || p->offline )
+    {
+        p->StartStream();
+    }
+    return p->periodSize;
+}
+
+unsigned int AudioDevice::GetPeriodSize() const
+{
+    return p->periodSize;
+}
+
 unsigned int AudioDevice::GetSampleRate() const
 {
     return p->sampleRate;
 }
 
+uint64_t AudioDevice::GetUnderrunCount() const
+{
+    return p->underrunCount;
+}
+
+uint64_t AudioDevice::GetOverrunCount() const
+{
+    return p->overrunCount;
+}
+
+AudioDevice::TimingStats AudioDevice::GetTimingStats() const
+{
+    TimingStats stats;
+    stats.callbackJitter = p->callbackJitter.Get();
+    stats.callbackDuration = p->callbackDuration.Get();
+    stats.processWait = p->processWait.Get();
+    stats.processTimeouts = p->processTimeouts;
+    stats.inputOverflows = p->inputOverflows;
+    stats.outputUnderflows = p->outputUnderflows;
+    return stats;
+}
+
+void AudioDevice::ResetTimingStats()
+{
+    p->callbackJitter.Reset();
+    p->callbackDuration.Reset();
+    p->processWait.Reset();
+    p->processTimeouts = 0;
+    p->inputOverflows = 0;
+    p->outputUnderflows = 0;
+}
+
+void AudioDevice::SetTimingDumpInterval( int intervalMs )
+{
+    {
+        std::lock_guard<std::mutex> lock( p->dumpMutex );
+        p->dumpIntervalMs = 0;
+        p->dumpCondt.notify_all();
+    }
+    if ( p->dumpThread.joinable() )
+    {
+        p->dumpThread.join();
+    }
+
+    if ( intervalMs > 0 )
+    {
+        p->dumpIntervalMs = intervalMs;
+        p->dumpThread = std::thread( [this]() {
+            std::unique_lock<std::mutex> lock( p->dumpMutex );
+            while ( p->dumpIntervalMs > 0 )
+            {
+                p->dumpCondt.wait_for( lock, std::chrono::milliseconds( p->dumpIntervalMs ) );
+                if ( p->dumpIntervalMs > 0 )
+                {
+                    PrintTimingStats( GetTimingStats() );
+                }
+            }
+        } );
+    }
+}
+
+void AudioDevice::SetRealtimeOptions( RealtimeOptions const& options )
+{
+    p->StopStream();
+
+    {
+        std::lock_guard<std::mutex> lock( p->realtimeMutex );
+        p->realtimeOptions = options;
+        p->realtimeStatus = RealtimeOptions();
+    }
+
+    if ( p->currentDeviceId != 0 || p->offline )
+    {
+        p->StartStream();
+    }
+}
+
+AudioDevice::RealtimeOptions AudioDevice::GetRealtimeOptions() const
+{
+    std::lock_guard<std::mutex> lock( p->realtimeMutex );
+    return p->realtimeOptions;
+}
+
+AudioDevice::RealtimeOptions AudioDevice::GetRealtimeStatus() const
+{
+    std::lock_guard<std::mutex> lock( p->realtimeMutex );
+    auto status = p->realtimeStatus;
+    if ( !p->priorityApplied )
+    {
+        status.priority = 0;
+    }
+    if ( !p->affinityApplied )
+    {
+        status.cpus.clear();
+    }
+    return status;
+}
+
 void AudioDevice::ShowWarnings( bool enabled )
 {
     p->audioStream.showWarnings( enabled );
@@ -452,87 +1285,308 @@ void AudioDevice::Process_( SignalBus& inputs, SignalBus& outputs )
 {
     std::unique_lock<std::mutex> processLock( p->processMutex );
 
-    // Wait until the sound card is ready for the next set of buffers
-    // ==============================================================
+    if ( p->changePending )
+    {
+        // apply the device change the monitor thread found (see Available_()), with the stream free to restart
+        processLock.unlock();
+        std::lock_guard<std::mutex> lock( p->availableMutex );
+        if ( p->changePending )
+        {
+            auto change = std::move( p->pendingChange );
+            p->pendingChange = nullptr;
+            p->changePending = false;
+            change();
+        }
+        return;
+    }
+
+    if ( !p->deviceAvailable )
+    {
+        // the monitor thread is looking for the device, keep the graph ticking at the device's pace meanwhile
+        processLock.unlock();
+        std::this_thread::sleep_for( std::chrono::microseconds( (int64_t)p->bufferSize * 1000000 / p->sampleRate ) );
+        return;
+    }
+
+    // Move over to staged queues (see SwitchBufferSize()): outputs once the graph's blocks have changed size (or
+    // straight away if only the number of blocks has changed), inputs once the callback has moved over and every block it captured at the old size has been read
+    // (published as we return, and "settled" once nothing here can touch the old queues again)
+    // ========================================================================================================
+    auto outputQueues = p->processOutput.load( std::memory_order_relaxed );
+    auto inputQueues = p->processInput.load( std::memory_order_relaxed );
+    if ( !outputQueues || !inputQueues )
+    {
+        // no stream has been started yet (e.g. no devices at all), so just keep the graph ticking at the device's pace
+        processLock.unlock();
+        std::this_thread::sleep_for( std::chrono::microseconds( (int64_t)p->bufferSize * 1000000 / p->sampleRate ) );
+        return;
+    }
+    if ( auto nextQueues = p->nextQueues.load( std::memory_order_acquire ) )
     {
+        if ( outputQueues != nextQueues )
+        {
+            auto buffer = inputs.GetValue<std::vector<short>>( 0 );
+            if ( p->outputParams.nChannels == 0 || !buffer || buffer->size() != outputQueues->blockSize ||
+                 nextQueues->blockSize == outputQueues->blockSize )
+            {
+                outputQueues = nextQueues;
+            }
+        }
+        if ( inputQueues != nextQueues && p->callbackInput.load( std::memory_order_acquire ) == nextQueues &&
+             !inputQueues->inputRing.ReadSlot() )
+        {
+            inputQueues = nextQueues;
+        }
+    }
+
+    const bool settled = outputQueues == inputQueues && p->callbackOutput.load( std::memory_order_acquire ) == outputQueues;
+    auto publish = [p = p.get(), outputQueues, inputQueues, settled]() {
+        p->processOutput.store( outputQueues, std::memory_order_release );
+        p->processInput.store( inputQueues, std::memory_order_release );
+        if ( settled )
+        {
+            p->processSettled.store( outputQueues, std::memory_order_release );
+        }
+    };
+
+    // Wait until the sound card has room for the next set of buffers
+    // ===============================================================
+    auto nextOutputBlock = [p = p.get(), outputQueues]() -> std::vector<std::vector<short>>* {
+        auto playing = p->callbackOutput.load( std::memory_order_acquire );
+        if ( playing != outputQueues && outputQueues->outputRing.Size() != 0 &&
+             playing->OutputFrames() + outputQueues->OutputFrames() >= outputQueues->outputRing.Capacity() * outputQueues->blockSize )
+        {
+            return nullptr;  // (blocks of the old size are still playing: keep the total queued within the new capacity)
+        }
+        return outputQueues->outputRing.WriteSlot();
+    };
+
+    auto waitStart = std::chrono::steady_clock::now();
+    auto outputBlock = nextOutputBlock();
+    if ( !outputBlock )
+    {
+        // (the callback notifies without taking syncMutex, so poll in case a notification slips past)
+        auto timeout = waitStart + std::chrono::milliseconds( c_bufferWaitTimeoutMs );
         std::unique_lock<std::mutex> lock( p->syncMutex );
-        if ( !p->gotSyncReady )  // if haven't already got the release
+        while ( !( outputBlock = nextOutputBlock() ) )
         {
-            if ( p->syncCondt.wait_for( lock, std::chrono::milliseconds( c_bufferWaitTimeoutMs ) ) == std::cv_status::timeout )
+            if ( std::chrono::steady_clock::now() >= timeout )
             {
-                lock.unlock();
-                processLock.unlock();
-                if ( !Available() && IsStreaming() )
-                {
-                    std::cout << p->currentDevice.name << " disconnected." << std::endl;
-                }
+                ++p->processTimeouts;
+                publish();
+
+                // hand the device check to the monitor thread rather than enumerating devices here
+                std::lock_guard<std::mutex> monitorLock( p->monitorMutex );
+                p->checkRequested = true;
+                p->monitorCondt.notify_all();
                 return;
             }
+            p->syncCondt.wait_for( lock, std::chrono::milliseconds( c_syncPollIntervalMs ) );
         }
-        p->gotSyncReady = false;  // reset the release flag
     }
 
-    // Retrieve incoming component buffers for the sound card to output
-    // ================================================================
-    const size_t outputCount = p->outputChannels.size();
+    // Queue incoming component buffers for the sound card to output
+    // =============================================================
+    const size_t outputCount = outputBlock->size();
     for ( size_t i = 0; i < outputCount; ++i )
     {
         auto buffer = inputs.GetValue<std::vector<short>>( (int)i );
-        if ( buffer && buffer->size() == p->bufferSize )
+        auto& outputChannel = ( *outputBlock )[i];
+        if ( buffer && buffer->size() == outputChannel.size() )
         {
-            p->outputChannels[i] = *buffer;
+            // trade the input buffer for the block's (stale) channel buffer rather than copying it
+            std::swap( *buffer, outputChannel );
         }
         else
         {
-            p->outputChannels[i].assign( p->bufferSize, 0 );
+            std::fill( outputChannel.begin(), outputChannel.end(), 0 );
+        }
+    }
+    outputQueues->outputRing.Push();
+
+    auto now = std::chrono::steady_clock::now();
+    p->processWait.Add( std::chrono::duration_cast<std::chrono::microseconds>( now - waitStart ).count() );
+    if ( p->lastProcessTime != std::chrono::steady_clock::time_point() )
+    {
+        auto interval = std::chrono::duration_cast<std::chrono::microseconds>( now - p->lastProcessTime ).count();
+        if ( interval > p->maxProcessIntervalUs )
+        {
+            p->maxProcessIntervalUs = interval;
         }
     }
+    p->lastProcessTime = now;
 
-    // Retrieve incoming sound card buffers for the component to output
-    // ================================================================
-    const size_t inputCount = p->inputChannels.size();
+    // Retrieve queued sound card buffers for the component to output
+    // ==============================================================
+    auto inputBlock = inputQueues->inputRing.ReadSlot();
+    const size_t inputCount = inputQueues->silence.size();
     for ( size_t i = 0; i < inputCount; ++i )
     {
-        outputs.SetValue( (int)i, p->inputChannels[i] );
+        if ( !inputBlock )
+        {
+            outputs.SetValue( (int)i, inputQueues->silence[i] );
+            continue;
+        }
+
+        // trade the block's channel buffer for the buffer last output on this channel (when handed back to us)
+        auto& inputChannel = ( *inputBlock )[i];
+        auto buffer = outputs.GetValue<std::vector<short>>( (int)i );
+        if ( buffer && buffer->size() == inputChannel.size() )
+        {
+            std::swap( *buffer, inputChannel );
+        }
+        else
+        {
+            outputs.SetValue( (int)i, inputChannel );
+        }
+    }
+    if ( inputBlock )
+    {
+        inputQueues->inputRing.Pop();
+    }
+
+    publish();
+
+    if ( p->offline && !p->paced )
+    {
+        // wake the offline clock, which waits for us rather than the wall clock (see RunClock())
+        std::lock_guard<std::mutex> lock( p->syncMutex );
+        p->syncCondt.notify_all();
     }
 
-    // Inform the sound card that buffers are now ready
-    // ================================================
-    std::lock_guard<std::mutex> lock( p->buffersMutex );
-    p->gotWaitReady = true;     // set release flag
-    p->waitCondt.notify_all();  // release sync
+    // Trade blocks with aggregated devices through their resampling FIFOs
+    // ====================================================================
+    int inputIndex = (int)outputCount;
+    int outputIndex = (int)inputCount;
+    for ( auto& aggregate : p->aggregates )
+    {
+        aggregate->lastProcessNs.store( internal::AggregateDevice::Now(), std::memory_order_relaxed );
+
+        auto& scratch = aggregate->processScratch;
+        const size_t frameCount = p->bufferSize;
+
+        if ( aggregate->outputCount != 0 )
+        {
+            const size_t channelCount = aggregate->outputCount;
+            for ( size_t c = 0; c < channelCount; ++c )
+            {
+                auto buffer = inputs.GetValue<std::vector<short>>( inputIndex++ );
+                bool valid = buffer && buffer->size() == frameCount;
+                for ( size_t j = 0; j < frameCount; ++j )
+                {
+                    scratch[j * channelCount + c] = valid ? ( *buffer )[j] : 0;
+                }
+            }
+            if ( aggregate->running && !aggregate->outputFifo.Write( scratch.data(), frameCount * channelCount ) )
+            {
+                ++aggregate->overrunCount;
+            }
+        }
+
+        if ( aggregate->inputCount != 0 )
+        {
+            const size_t channelCount = aggregate->inputCount;
+
+            // wait for the FIFO to reach its target fill before reading from it
+            aggregate->inputPrimed = aggregate->inputPrimed || aggregate->inputFifo.Size() >= aggregate->targetFrames * channelCount;
+            if ( !aggregate->inputPrimed || !aggregate->inputFifo.Read( scratch.data(), frameCount * channelCount ) )
+            {
+                std::fill( scratch.begin(), scratch.end(), 0 );
+                if ( aggregate->inputPrimed )
+                {
+                    ++aggregate->underrunCount;
+                }
+            }
+
+            for ( size_t c = 0; c < channelCount; ++c )
+            {
+                auto buffer = outputs.GetValue<std::vector<short>>( outputIndex );
+                if ( !buffer || buffer->size() != frameCount )
+                {
+                    outputs.SetValue( outputIndex, std::vector<short>( frameCount ) );
+                    buffer = outputs.GetValue<std::vector<short>>( outputIndex );
+                }
+                for ( size_t j = 0; j < frameCount; ++j )
+                {
+                    ( *buffer )[j] = scratch[j * channelCount + c];
+                }
+                ++outputIndex;
+            }
+        }
+    }
 }
 
-void DSPatchables::internal::AudioDevice::WaitForBuffer()
+bool DSPatchables::internal::AudioDevice::LoadDevices()
 {
-    std::unique_lock<std::mutex> lock( buffersMutex );
-    if ( !gotWaitReady )  // if haven't already got the release
+    // Probe the driver once, then compare complete device infos (not just IDs) against the last snapshot
+    std::vector<RtAudio::DeviceInfo> newDeviceInfos;
     {
-        waitCondt.wait_for( lock, std::chrono::seconds( c_syncWaitTimeoutS ) );  // wait for sync
+        std::lock_guard<std::mutex> lock( probeMutex );
+        for ( auto id : audioStream.getDeviceIds() )
+        {
+            newDeviceInfos.push_back( audioStream.getDeviceInfo( id ) );
+            SanitizeDeviceName( newDeviceInfos.back().name );
+        }
+    }
+
+    std::lock_guard<std::mutex> lock( devicesMutex );
+
+    if ( newDeviceInfos.size() == deviceInfos.size() &&
+         std::equal( newDeviceInfos.begin(), newDeviceInfos.end(), deviceInfos.begin(), &SameDeviceInfo ) )
+    {
+        return false;
+    }
+
+    deviceInfos = std::move( newDeviceInfos );
+    deviceList.clear();
+    for ( auto const& deviceInfo : deviceInfos )
+    {
+        deviceList.push_back( deviceInfo.ID );
     }
-    gotWaitReady = false;  // reset the release flag
+    return true;
 }
 
-void DSPatchables::internal::AudioDevice::SyncBuffer()
+RtAudio::DeviceInfo DSPatchables::internal::AudioDevice::GetDeviceInfo( unsigned int deviceId ) const
 {
-    std::lock_guard<std::mutex> lock( syncMutex );
-    gotSyncReady = true;     // set release flag
-    syncCondt.notify_all();  // release sync
+    std::lock_guard<std::mutex> lock( devicesMutex );
+
+    for ( auto const& deviceInfo : deviceInfos )
+    {
+        if ( deviceInfo.ID == deviceId )
+        {
+            return deviceInfo;
+        }
+    }
+    return RtAudio::DeviceInfo();
 }
 
 void DSPatchables::internal::AudioDevice::StopStream()
 {
     isStreaming = false;
 
-    buffersMutex.lock();
-    gotWaitReady = true;     // set release flag
-    waitCondt.notify_all();  // release sync
-    buffersMutex.unlock();
+    if ( clockThread.joinable() )
+    {
+        clockThread.join();
+    }
 
-    if ( audioStream.isStreamOpen() )
+    for ( int slot = 0; slot < 2; ++slot )
     {
-        std::lock_guard<std::mutex> lock( processMutex );  // wait for Process_() to exit
-        audioStream.closeStream();
+        if ( Stream( slot ).isStreamOpen() )
+        {
+            std::lock_guard<std::mutex> lock( processMutex );  // wait for Process_() to exit
+            Stream( slot ).closeStream();
+        }
+    }
+
+    for ( auto& aggregate : aggregates )
+    {
+        aggregate->Stop();
+    }
+
+    if ( memoryLocked )
+    {
+        unlock_memory();
+        memoryLocked = false;
     }
 }
 
@@ -551,57 +1605,808 @@ void DSPatchables::internal::AudioDevice::StartStream()
         outParams = &outputParams;
     }
 
-    RtAudio::StreamOptions options;
-    options.flags = RTAUDIO_NONINTERLEAVED;
-    options.flags |= RTAUDIO_SCHEDULE_REALTIME;
-
-    audioStream.openStream( outParams, inParams, RTAUDIO_SINT16, sampleRate, &bufferSize, &StaticCallback, this, &options );
+    // ask the driver for the requested period (it may grant another): the callback re-blocks to bufferSize either way
+    periodSize = requestedPeriodSize != 0 ? requestedPeriodSize : bufferSize.load();
 
-    isStreaming = true;
+    DSPatchables::AudioDevice::RealtimeOptions realtime;
+    {
+        std::lock_guard<std::mutex> lock( realtimeMutex );
+        realtime = realtimeOptions;
+    }
+    threadSettings = make_thread_settings( realtime.priority, realtime.cpus );
+    priorityApplied = false;
+    affinityApplied = false;
 
-    audioStream.startStream();
-}
+    if ( offline )
+    {
+        streamFormat = RTAUDIO_SINT16;
+    }
+    else
+    {
+        RtAudio::StreamOptions options;
+        options.flags = RTAUDIO_SCHEDULE_REALTIME;  // (interleaved, like the devices themselves)
+        options.priority = threadSettings.priority;
 
-int DSPatchables::internal::AudioDevice::StaticCallback(
-    void* outputBuffer, void* inputBuffer, unsigned int, double, RtAudioStreamStatus status, void* userData )
-{
-    return ( static_cast<AudioDevice*>( userData ) )->DynamicCallback( inputBuffer, outputBuffer, status );
-}
+        streamFormat = NegotiateFormat( currentDevice.nativeFormats );
 
-int DSPatchables::internal::AudioDevice::DynamicCallback( void* inputBuffer, void* outputBuffer, RtAudioStreamStatus )
-{
-    WaitForBuffer();
+        activeSlot = 0;
+        handoffSlot = -1;
+        std::lock_guard<std::mutex> lock( probeMutex );
+        audioStream.openStream( outParams, inParams, streamFormat, sampleRate, &periodSize, &StaticCallback, &streamSlots[0], &options );
+    }
 
-    if ( isStreaming )
+    // Preallocate every block up front so that the callback never allocates
     {
-        short* shortOutput = static_cast<short*>( outputBuffer );
-        short* shortInput = static_cast<short*>( inputBuffer );
+        std::lock_guard<std::mutex> lock( processMutex );
 
-        if ( outputBuffer != nullptr )
+        // the driver's period may differ from the graph's block size: queue enough blocks to fill bufferDepth periods
+        const size_t blocksPerPeriod = ( periodSize + bufferSize - 1 ) / bufferSize;
+        const size_t blockCount = bufferDepth * blocksPerPeriod;
+
+        queues = std::make_unique<BlockQueues>( bufferSize, blockCount, outputParams.nChannels, inputParams.nChannels );
+        stagedQueues.reset();
+        nextQueues = nullptr;
+        processOutput = processInput = processSettled = callbackOutput = callbackInput = queues.get();
+
+        lastProcessTime = std::chrono::steady_clock::time_point();  // (don't count the restart as a stall)
+        lastCallbackTime = std::chrono::steady_clock::time_point();
+
+        for ( auto& aggregate : aggregates )
         {
-            for ( auto& outputChannel : outputChannels )
+            aggregate->threadSettings = threadSettings;
+            aggregate->realtimePending = threadSettings.priority > 0 || threadSettings.pinned;
+            aggregate->running = aggregate->Start( sampleRate, bufferSize );
+            if ( !aggregate->running )
             {
-                if ( !outputChannel.empty() )
-                {
-                    memcpy( shortOutput, &outputChannel[0], outputChannel.size() * sizeof( short ) );
-                    shortOutput += outputChannel.size();
-                }
+                std::cout << "Failed to start " << aggregate->deviceInfo.name << ", its channels will be silent." << std::endl;
+                aggregate->Stop();
             }
         }
+    }
+
+    if ( offline )
+    {
+        offlineOutput.assign( outputParams.nChannels * periodSize, 0 );
+        offlineInput.assign( inputParams.nChannels * periodSize, 0 );  // (silence)
+    }
+
+    // lock (and so fault in) everything allocated above, and whatever gets allocated from here on (the audio
+    // threads' stacks included: they are mapped in full when the threads are created)
+    if ( realtime.lockMemory && !memoryLocked )
+    {
+        memoryLocked = lock_memory();
+    }
+    {
+        std::lock_guard<std::mutex> lock( realtimeMutex );
+        realtimeStatus = realtime;
+        realtimeStatus.lockMemory = memoryLocked;
+    }
+    realtimePending = threadSettings.priority > 0 || threadSettings.pinned;
+    realtimeReport = !realtimePending && realtime.lockMemory;  // (otherwise reported after the first callback)
+
+    isStreaming = true;
+
+    if ( offline )
+    {
+        clockThread = std::thread( &AudioDevice::RunClock, this );
+    }
+    else
+    {
+        audioStream.startStream();
+    }
+}
+
+void DSPatchables::internal::AudioDevice::RunClock()
+{
+    const auto period = std::chrono::nanoseconds( (int64_t)periodSize * 1000000000 / sampleRate );
+    auto nextTick = std::chrono::steady_clock::now();
+
+    void* outputBuffer = outputParams.nChannels != 0 ? offlineOutput.data() : nullptr;
+    void* inputBuffer = inputParams.nChannels != 0 ? offlineInput.data() : nullptr;
 
-        if ( inputBuffer != nullptr )
+    while ( isStreaming )
+    {
+        if ( paced )
         {
-            for ( auto& inputChannel : inputChannels )
-            {
-                if ( !inputChannel.empty() )
+            // tick in step with the wall clock, like a sound card would
+            nextTick += period;
+            std::this_thread::sleep_until( nextTick );
+        }
+        else
+        {
+            // tick as soon as Process_() has traded enough blocks for a period (so nothing is ever dropped)
+            auto ready = [this, inputBuffer]() {
+                auto outputQueues = callbackOutput.load( std::memory_order_relaxed );
+                auto inputQueues = callbackInput.load( std::memory_order_relaxed );
+                auto nextQueues = this->nextQueues.load( std::memory_order_acquire );
+
+                size_t outputFrames = outputQueues->OutputFrames();
+                if ( nextQueues && nextQueues != outputQueues && processOutput.load( std::memory_order_acquire ) == nextQueues )
                 {
-                    memcpy( &inputChannel[0], shortInput, inputChannel.size() * sizeof( short ) );
-                    shortInput += inputChannel.size();
+                    outputFrames += nextQueues->OutputFrames();  // (the callback moves over once it has played the rest)
                 }
+
+                // (while the blocks change size, just let input that finds no room be dropped: it is only silence)
+                return outputFrames >= periodSize && ( !inputBuffer || nextQueues || inputQueues->InputRoom() >= periodSize );
+            };
+
+            if ( !ready() )
+            {
+                // Process_() notifies under syncMutex once it has traded a block (the timeout only re-checks isStreaming)
+                std::unique_lock<std::mutex> lock( syncMutex );
+                syncCondt.wait_for( lock, std::chrono::milliseconds( c_syncPollIntervalMs ), ready );
+                continue;
             }
         }
+
+        DynamicCallback( inputBuffer, outputBuffer, periodSize, 0 );
     }
+}
 
-    SyncBuffer();
-    return 0;
+int DSPatchables::internal::AudioDevice::StaticCallback(
+    void* outputBuffer, void* inputBuffer, unsigned int nBufferFrames, double, RtAudioStreamStatus status, void* userData )
+{
+    auto streamSlot = static_cast<StreamSlot*>( userData );
+    return streamSlot->device->StreamCallback( streamSlot->index, inputBuffer, outputBuffer, nBufferFrames, status );
+}
+
+int DSPatchables::internal::AudioDevice::StreamCallback(
+    int slot, void* inputBuffer, void* outputBuffer, unsigned int frameCount, RtAudioStreamStatus status )
+{
+    if ( slot != activeSlot.load( std::memory_order_acquire ) )
+    {
+        // a standby stream waiting to take over (or a retired one waiting to be closed): keep quiet
+        if ( outputBuffer != nullptr )
+        {
+            memset( outputBuffer, 0, frameCount * outputParams.nChannels * FormatBytes( streamFormat ) );
+        }
+        return 0;
+    }
+
+    int result = DynamicCallback( inputBuffer, outputBuffer, frameCount, status );
+
+    if ( crossfadeIn )
+    {
+        FadeOutput( outputBuffer, frameCount, true );  // (the first period since taking over)
+        crossfadeIn = false;
+    }
+
+    int target = 1 - slot;
+    if ( handoffSlot.compare_exchange_strong( target, -1 ) )
+    {
+        // hand the rings over to the standby stream between periods, fading out the end of this one
+        FadeOutput( outputBuffer, frameCount, false );
+        crossfadeIn = true;
+        lastCallbackTime = std::chrono::steady_clock::time_point();
+        realtimePending = threadSettings.priority > 0 || threadSettings.pinned;
+        activeSlot.store( 1 - slot, std::memory_order_release );
+    }
+
+    return result;
+}
+
+int DSPatchables::internal::AudioDevice::DynamicCallback( void* inputBuffer,
+                                                          void* outputBuffer,
+                                                          unsigned int frameCount,
+                                                          RtAudioStreamStatus status )
+{
+    // Never lock, block or allocate in here: just trade blocks with Process_() via the rings
+    if ( realtimePending.exchange( false ) )
+    {
+        ApplyRealtimeOptions();  // (once per stream, before the first block)
+    }
+
+    auto callbackStart = std::chrono::steady_clock::now();
+    if ( lastCallbackTime != std::chrono::steady_clock::time_point() )
+    {
+        const auto periodUs = (int64_t)frameCount * 1000000 / sampleRate;
+        auto intervalUs = std::chrono::duration_cast<std::chrono::microseconds>( callbackStart - lastCallbackTime ).count();
+        callbackJitter.Add( std::abs( intervalUs - periodUs ) );
+    }
+    lastCallbackTime = callbackStart;
+
+    if ( status & RTAUDIO_OUTPUT_UNDERFLOW )
+    {
+        ++underrunCount;
+        ++outputUnderflows;
+    }
+    if ( status & RTAUDIO_INPUT_OVERFLOW )
+    {
+        ++overrunCount;
+        ++inputOverflows;
+    }
+
+    // Re-block between the graph's block size and the driver's period, a block at a time
+    // (always take blocks, even without outputs, as Process_() paces itself by the room left in outputRing)
+    auto nextQueues = this->nextQueues.load( std::memory_order_acquire );
+    auto outputQueues = callbackOutput.load( std::memory_order_relaxed );
+    const size_t outputFrameBytes = outputParams.nChannels * FormatBytes( streamFormat );
+    for ( size_t done = 0; done < frameCount; )
+    {
+        auto outputBlock = isStreaming ? outputQueues->outputRing.ReadSlot() : nullptr;
+        if ( !outputBlock && nextQueues && nextQueues != outputQueues && processOutput.load( std::memory_order_acquire ) == nextQueues &&
+             !outputQueues->outputRing.ReadSlot() )
+        {
+            // every block queued at the old size has played: carry on with the staged queues
+            outputQueues = nextQueues;
+            callbackOutput.store( outputQueues, std::memory_order_release );
+            outputBlock = isStreaming ? outputQueues->outputRing.ReadSlot() : nullptr;
+        }
+        if ( !outputBlock )
+        {
+            // Process_() fell behind: play silence
+            if ( outputBuffer != nullptr )
+            {
+                memset( static_cast<char*>( outputBuffer ) + done * outputFrameBytes, 0, ( frameCount - done ) * outputFrameBytes );
+            }
+            ++underrunCount;
+            break;
+        }
+
+        size_t outputBlockPos = outputQueues->outputBlockPos.load( std::memory_order_relaxed );
+        const size_t count = std::min<size_t>( frameCount - done, outputQueues->blockSize - outputBlockPos );
+        if ( outputBuffer != nullptr )
+        {
+            WriteOutput( *outputBlock, outputBlockPos, count, static_cast<char*>( outputBuffer ) + done * outputFrameBytes );
+        }
+        done += count;
+        outputBlockPos += count;
+
+        if ( outputBlockPos == outputQueues->blockSize )
+        {
+            outputQueues->outputRing.Pop();
+            outputBlockPos = 0;
+        }
+        outputQueues->outputBlockPos.store( outputBlockPos, std::memory_order_relaxed );
+    }
+
+    if ( inputBuffer != nullptr )
+    {
+        auto inputQueues = callbackInput.load( std::memory_order_relaxed );
+        const size_t inputFrameBytes = inputParams.nChannels * FormatBytes( streamFormat );
+        for ( size_t done = 0; done < frameCount; )
+        {
+            if ( nextQueues && nextQueues != inputQueues && inputQueues->inputBlockPos == 0 )
+            {
+                // between blocks: capture at the staged size from here on
+                inputQueues = nextQueues;
+                callbackInput.store( inputQueues, std::memory_order_release );
+            }
+
+            auto inputBlock = isStreaming ? inputQueues->inputRing.WriteSlot() : nullptr;
+            if ( !inputBlock )
+            {
+                // Process_() fell behind: drop the rest of this period
+                ++overrunCount;
+                break;
+            }
+
+            size_t inputBlockPos = inputQueues->inputBlockPos.load( std::memory_order_relaxed );
+            const size_t count = std::min<size_t>( frameCount - done, inputQueues->blockSize - inputBlockPos );
+            ReadInput( static_cast<char const*>( inputBuffer ) + done * inputFrameBytes, *inputBlock, inputBlockPos, count );
+            done += count;
+            inputBlockPos += count;
+
+            if ( inputBlockPos == inputQueues->blockSize )
+            {
+                inputQueues->inputRing.Push();
+                inputBlockPos = 0;
+            }
+            inputQueues->inputBlockPos.store( inputBlockPos, std::memory_order_relaxed );
+        }
+    }
+    else if ( nextQueues )
+    {
+        callbackInput.store( nextQueues, std::memory_order_release );  // (nothing to capture)
+    }
+
+    syncCondt.notify_all();  // release Process_()
+
+    callbackDuration.Add(
+        std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - callbackStart ).count() );
+    return 0;
+}
+
+bool DSPatchables::internal::AudioDevice::SwitchBufferSize( unsigned int newBufferSize )
+{
+    // (aggregates size their FIFOs by the block, so they restart with the stream)
+    if ( !isStreaming || !queues || !aggregates.empty() )
+    {
+        return false;
+    }
+
+    if ( !SettleQueues() )
+    {
+        return false;
+    }
+
+    StageQueues( newBufferSize, periodSize );
+    return true;
+}
+
+bool DSPatchables::internal::AudioDevice::SettleQueues()
+{
+    // Free the blocks of a previous switch once both sides have let go of them. Playback only moves over once the
+    // graph's blocks have changed size, so if it still hasn't, restarting the stream is no worse than waiting.
+    if ( stagedQueues )
+    {
+        auto next = stagedQueues.get();
+        if ( processSettled != next || callbackInput != next )
+        {
+            return false;
+        }
+        nextQueues = nullptr;
+        queues = std::move( stagedQueues );
+    }
+    return true;
+}
+
+void DSPatchables::internal::AudioDevice::StageQueues( unsigned int newBufferSize, unsigned int newPeriodSize )
+{
+    // (as in StartStream(), enough blocks to fill bufferDepth periods)
+    const size_t blocksPerPeriod = ( newPeriodSize + newBufferSize - 1 ) / newBufferSize;
+    const size_t blockCount = bufferDepth * blocksPerPeriod;
+    if ( newBufferSize == bufferSize && blockCount == queues->outputRing.Capacity() )
+    {
+        return;
+    }
+
+    // Allocate the new blocks here, off the audio threads, then let each side move over at a block boundary
+    stagedQueues = std::make_unique<BlockQueues>( newBufferSize, blockCount, outputParams.nChannels, inputParams.nChannels );
+    bufferSize = newBufferSize;
+    nextQueues.store( stagedQueues.get(), std::memory_order_release );
+
+    // (the old blocks are kept until the next switch or restart, so the caller never waits on the graph here)
+}
+
+bool DSPatchables::internal::AudioDevice::SwitchSampleRate( unsigned int newSampleRate )
+{
+    // (offline, the clock simply restarts; aggregates resample to this device's rate, so they restart with the stream)
+    if ( !isStreaming || offline || !aggregates.empty() || !queues || !SettleQueues() )
+    {
+        return false;
+    }
+
+    // Open the device again at the new rate, alongside the running stream (devices that only allow one stream refuse)
+    const int slot = activeSlot;
+    auto& standby = Stream( 1 - slot );
+
+    RtAudio::StreamOptions options;
+    options.flags = RTAUDIO_SCHEDULE_REALTIME;
+    options.priority = threadSettings.priority;
+
+    unsigned int newPeriodSize = requestedPeriodSize != 0 ? requestedPeriodSize : bufferSize.load();
+    if ( standby.openStream( outputParams.nChannels != 0 ? &outputParams : nullptr,
+                             inputParams.nChannels != 0 ? &inputParams : nullptr,
+                             streamFormat,
+                             newSampleRate,
+                             &newPeriodSize,
+                             &StaticCallback,
+                             &streamSlots[1 - slot],
+                             &options ) != RTAUDIO_NO_ERROR )
+    {
+        return false;
+    }
+    if ( standby.startStream() != RTAUDIO_NO_ERROR )
+    {
+        standby.closeStream();
+        return false;
+    }
+
+    // The driver may have chosen a different period at the new rate: queue blocks to suit it from here on
+    // (if the handover below fails, the caller restarts the stream, which sizes the queues afresh anyway)
+    StageQueues( bufferSize, newPeriodSize );
+
+    // Have the running stream hand over at the end of its next period
+    handoffSlot = 1 - slot;
+    auto timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds( c_reconfigureTimeoutMs );
+    while ( activeSlot == slot && std::chrono::steady_clock::now() < timeout )
+    {
+        std::this_thread::sleep_for( std::chrono::milliseconds( c_syncPollIntervalMs ) );
+    }
+
+    int target = 1 - slot;
+    if ( handoffSlot.compare_exchange_strong( target, -1 ) )
+    {
+        // the running stream never got round to it (stalled or disconnected)
+        standby.closeStream();
+        return false;
+    }
+    while ( activeSlot == slot )
+    {
+        std::this_thread::yield();  // (claimed, about to be published)
+    }
+
+    Stream( slot ).closeStream();
+    sampleRate = newSampleRate;
+    periodSize = newPeriodSize;
+    return true;
+}
+
+void DSPatchables::internal::AudioDevice::ApplyRealtimeOptions()
+{
+    // (just the two calls: GetRealtimeStatus() puts the status together from these flags)
+    priorityApplied = threadSettings.priority > 0 && set_thread_priority( threadSettings.priority );
+    affinityApplied = set_thread_affinity( threadSettings );
+    realtimeReport = true;  // (the monitor thread prints the outcome)
+}
+
+void DSPatchables::internal::AudioDevice::WriteOutput( std::vector<std::vector<short>> const& block,
+                                                      size_t offset,
+                                                      size_t count,
+                                                      void* outputBuffer )
+{
+    if ( streamFormat == RTAUDIO_SINT32 )
+    {
+        Interleave( block, offset, count, static_cast<int32_t*>( outputBuffer ), []( short sample ) { return sample * 65536; } );
+    }
+    else if ( streamFormat == RTAUDIO_FLOAT32 )
+    {
+        Interleave(
+            block, offset, count, static_cast<float*>( outputBuffer ), []( short sample ) { return sample * ( 1.0f / 32768.0f ); } );
+    }
+    else if ( streamFormat == RTAUDIO_FLOAT64 )
+    {
+        Interleave(
+            block, offset, count, static_cast<double*>( outputBuffer ), []( short sample ) { return sample * ( 1.0 / 32768.0 ); } );
+    }
+    else
+    {
+        Interleave( block, offset, count, static_cast<short*>( outputBuffer ), []( short sample ) { return sample; } );
+    }
+}
+
+void DSPatchables::internal::AudioDevice::ReadInput( void const* inputBuffer,
+                                                     std::vector<std::vector<short>>& block,
+                                                     size_t offset,
+                                                     size_t count )
+{
+    if ( streamFormat == RTAUDIO_SINT32 )
+    {
+        Deinterleave( static_cast<int32_t const*>( inputBuffer ), block, offset, count, []( int32_t sample ) {
+            return static_cast<short>( sample >> 16 );
+        } );
+    }
+    else if ( streamFormat == RTAUDIO_FLOAT32 )
+    {
+        Deinterleave( static_cast<float const*>( inputBuffer ), block, offset, count, []( float sample ) {
+            return static_cast<short>( std::min( std::max( sample * 32768.0f, -32768.0f ), 32767.0f ) );
+        } );
+    }
+    else if ( streamFormat == RTAUDIO_FLOAT64 )
+    {
+        Deinterleave( static_cast<double const*>( inputBuffer ), block, offset, count, []( double sample ) {
+            return static_cast<short>( std::min( std::max( sample * 32768.0, -32768.0 ), 32767.0 ) );
+        } );
+    }
+    else
+    {
+        Deinterleave( static_cast<short const*>( inputBuffer ), block, offset, count, []( short sample ) { return sample; } );
+    }
+}
+
+void DSPatchables::internal::AudioDevice::FadeOutput( void* outputBuffer, size_t frameCount, bool fadeIn )
+{
+    if ( outputBuffer == nullptr )
+    {
+        return;
+    }
+
+    const size_t channelCount = outputParams.nChannels;
+    if ( streamFormat == RTAUDIO_SINT32 )
+    {
+        Fade( static_cast<int32_t*>( outputBuffer ), frameCount, channelCount, fadeIn );
+    }
+    else if ( streamFormat == RTAUDIO_FLOAT32 )
+    {
+        Fade( static_cast<float*>( outputBuffer ), frameCount, channelCount, fadeIn );
+    }
+    else if ( streamFormat == RTAUDIO_FLOAT64 )
+    {
+        Fade( static_cast<double*>( outputBuffer ), frameCount, channelCount, fadeIn );
+    }
+    else
+    {
+        Fade( static_cast<short*>( outputBuffer ), frameCount, channelCount, fadeIn );
+    }
+}
+
+template <typename Sample>
+void DSPatchables::internal::AudioDevice::Fade( Sample* buffer, size_t frameCount, size_t channelCount, bool fadeIn )
+{
+    const size_t fadeFrames = std::min( frameCount, c_crossfadeFrames );
+    Sample* samples = fadeIn ? buffer : buffer + ( frameCount - fadeFrames ) * channelCount;
+    for ( size_t j = 0; j < fadeFrames; ++j )
+    {
+        const double gain = fadeIn ? (double)j / fadeFrames : (double)( fadeFrames - 1 - j ) / fadeFrames;
+        for ( size_t i = 0; i < channelCount; ++i )
+        {
+            samples[j * channelCount + i] = static_cast<Sample>( samples[j * channelCount + i] * gain );
+        }
+    }
+}
+
+template <typename Sample, typename Converter>
+void DSPatchables::internal::AudioDevice::Interleave(
+    std::vector<std::vector<short>> const& block, size_t offset, size_t count, Sample* out, Converter convert )
+{
+    const size_t channelCount = block.size();
+
+    // unroll the common stereo case so that the compiler can vectorize it
+    if ( channelCount == 2 )
+    {
+        const short* left = block[0].data() + offset;
+        const short* right = block[1].data() + offset;
+        for ( size_t j = 0; j < count; ++j )
+        {
+            out[j * 2] = convert( left[j] );
+            out[j * 2 + 1] = convert( right[j] );
+        }
+        return;
+    }
+
+    for ( size_t i = 0; i < channelCount; ++i )
+    {
+        const short* in = block[i].data() + offset;
+        for ( size_t j = 0; j < count; ++j )
+        {
+            out[j * channelCount + i] = convert( in[j] );
+        }
+    }
+}
+
+template <typename Sample, typename Converter>
+void DSPatchables::internal::AudioDevice::Deinterleave(
+    Sample const* in, std::vector<std::vector<short>>& block, size_t offset, size_t count, Converter convert )
+{
+    const size_t channelCount = block.size();
+
+    // unroll the common stereo case so that the compiler can vectorize it
+    if ( channelCount == 2 )
+    {
+        short* left = block[0].data() + offset;
+        short* right = block[1].data() + offset;
+        for ( size_t j = 0; j < count; ++j )
+        {
+            left[j] = convert( in[j * 2] );
+            right[j] = convert( in[j * 2 + 1] );
+        }
+        return;
+    }
+
+    for ( size_t i = 0; i < channelCount; ++i )
+    {
+        short* out = block[i].data() + offset;
+        for ( size_t j = 0; j < count; ++j )
+        {
+            out[j] = convert( in[j * channelCount + i] );
+        }
+    }
+}
+
+bool DSPatchables::internal::AggregateDevice::Start( unsigned int sampleRate, unsigned int bufferSize )
+{
+    outputCount = deviceInfo.outputChannels;
+    inputCount = deviceInfo.inputChannels;
+    blockSize = bufferSize;
+    blockNs = bufferSize * 1e9 / sampleRate;
+
+    RtAudio::StreamParameters outputParams;
+    outputParams.deviceId = deviceInfo.ID;
+    outputParams.nChannels = outputCount;
+
+    RtAudio::StreamParameters inputParams;
+    inputParams.deviceId = deviceInfo.ID;
+    inputParams.nChannels = inputCount;
+
+    RtAudio::StreamOptions options;
+    options.flags = RTAUDIO_SCHEDULE_REALTIME;
+    options.priority = threadSettings.priority;
+
+    // (like the main device, in a format the device handles natively where there is one)
+    streamFormat = AudioDevice::NegotiateFormat( deviceInfo.nativeFormats );
+
+    unsigned int periodSize = bufferSize;
+    bool opened = audioStream.openStream( outputCount != 0 ? &outputParams : nullptr,
+                                          inputCount != 0 ? &inputParams : nullptr,
+                                          streamFormat,
+                                          sampleRate,
+                                          &periodSize,
+                                          &StaticCallback,
+                                          this,
+                                          &options ) == RTAUDIO_NO_ERROR;
+
+    // hold a few blocks (of whichever side's are larger) in each FIFO, leaving plenty of headroom either side
+    targetFrames = c_aggregateTargetBlocks * std::max( blockSize, periodSize );
+    const size_t capacityFrames = 4 * targetFrames;
+
+    outputFifo.Reset( capacityFrames * outputCount );
+    outputDrift.Reset();
+    outputPrev.assign( outputCount, 0.0f );
+    outputNext.assign( outputCount, 0.0f );
+    outputFrame.assign( outputCount, 0 );
+    outputPhase = 1.0;
+    outputPrimed = false;
+
+    inputFifo.Reset( capacityFrames * inputCount );
+    inputDrift.Reset();
+    inputPrev.assign( inputCount, 0.0f );
+    inputNext.assign( inputCount, 0.0f );
+    inputFrame.assign( inputCount, 0 );
+    inputPhase = 0.0;
+    inputPrimed = false;
+
+    processScratch.assign( blockSize * std::max( outputCount, inputCount ), 0 );
+
+    return opened && audioStream.startStream() == RTAUDIO_NO_ERROR;
+}
+
+void DSPatchables::internal::AggregateDevice::Stop()
+{
+    if ( audioStream.isStreamOpen() )
+    {
+        audioStream.closeStream();
+    }
+}
+
+int DSPatchables::internal::AggregateDevice::StaticCallback(
+    void* outputBuffer, void* inputBuffer, unsigned int nBufferFrames, double, RtAudioStreamStatus, void* userData )
+{
+    auto aggregate = static_cast<AggregateDevice*>( userData );
+    auto nowNs = Now();
+
+    if ( aggregate->realtimePending.exchange( false ) )
+    {
+        // (once per stream, like the main device's callback)
+        if ( aggregate->threadSettings.priority > 0 )
+        {
+            set_thread_priority( aggregate->threadSettings.priority );
+        }
+        set_thread_affinity( aggregate->threadSettings );
+    }
+
+    if ( outputBuffer != nullptr )
+    {
+        aggregate->Playback( outputBuffer, nBufferFrames, nowNs );
+    }
+
+    if ( inputBuffer != nullptr )
+    {
+        aggregate->Capture( inputBuffer, nBufferFrames, nowNs );
+    }
+
+    return 0;
+}
+
+void DSPatchables::internal::AggregateDevice::Playback( void* out, unsigned int frameCount, int64_t nowNs )
+{
+    if ( streamFormat == RTAUDIO_SINT32 )
+    {
+        Playback( static_cast<int32_t*>( out ), frameCount, nowNs, []( float sample ) {
+            return static_cast<int32_t>( std::lrint( sample ) ) * 65536;
+        } );
+    }
+    else if ( streamFormat == RTAUDIO_FLOAT32 )
+    {
+        Playback( static_cast<float*>( out ), frameCount, nowNs, []( float sample ) { return sample * ( 1.0f / 32768.0f ); } );
+    }
+    else if ( streamFormat == RTAUDIO_FLOAT64 )
+    {
+        Playback( static_cast<double*>( out ), frameCount, nowNs, []( float sample ) { return sample * ( 1.0 / 32768.0 ); } );
+    }
+    else
+    {
+        Playback( static_cast<short*>( out ), frameCount, nowNs, []( float sample ) {
+            return static_cast<short>( std::lrint( sample ) );
+        } );
+    }
+}
+
+void DSPatchables::internal::AggregateDevice::Capture( void const* in, unsigned int frameCount, int64_t nowNs )
+{
+    if ( streamFormat == RTAUDIO_SINT32 )
+    {
+        Capture( static_cast<int32_t const*>( in ), frameCount, nowNs, []( int32_t sample ) {
+            return static_cast<short>( sample >> 16 );
+        } );
+    }
+    else if ( streamFormat == RTAUDIO_FLOAT32 )
+    {
+        Capture( static_cast<float const*>( in ), frameCount, nowNs, []( float sample ) {
+            return static_cast<short>( std::min( std::max( sample * 32768.0f, -32768.0f ), 32767.0f ) );
+        } );
+    }
+    else if ( streamFormat == RTAUDIO_FLOAT64 )
+    {
+        Capture( static_cast<double const*>( in ), frameCount, nowNs, []( double sample ) {
+            return static_cast<short>( std::min( std::max( sample * 32768.0, -32768.0 ), 32767.0 ) );
+        } );
+    }
+    else
+    {
+        Capture( static_cast<short const*>( in ), frameCount, nowNs, []( short sample ) { return sample; } );
+    }
+}
+
+template <typename Sample, typename Converter>
+void DSPatchables::internal::AggregateDevice::Playback( Sample* out, unsigned int frameCount, int64_t nowNs, Converter convert )
+{
+    const size_t channelCount = outputCount;
+    const size_t fill = outputFifo.Size() / channelCount;
+
+    // wait for the FIFO to reach its target fill before reading from it
+    if ( !outputPrimed && fill < targetFrames )
+    {
+        memset( out, 0, frameCount * channelCount * sizeof( Sample ) );
+        return;
+    }
+    outputPrimed = true;
+
+    // consume main device frames a touch faster or slower than we play them to hold the FIFO at its target
+    const double smoothFill = fill - blockSize * ( 1.0 - BlockProgress( nowNs ) );
+    const double ratio = outputDrift.Update( smoothFill, (double)targetFrames, (double)blockSize );
+
+    for ( size_t j = 0; j < frameCount; ++j )
+    {
+        while ( outputPhase >= 1.0 )
+        {
+            std::swap( outputPrev, outputNext );
+            if ( outputFifo.Read( outputFrame.data(), channelCount ) )
+            {
+                std::copy( outputFrame.begin(), outputFrame.end(), outputNext.begin() );
+            }
+            else
+            {
+                outputNext = outputPrev;  // (hold the last frame)
+                ++underrunCount;
+            }
+            outputPhase -= 1.0;
+        }
+
+        // linear interpolation between the two frames either side of the read position
+        const float phase = (float)outputPhase;
+        for ( size_t c = 0; c < channelCount; ++c )
+        {
+            out[j * channelCount + c] = convert( outputPrev[c] + ( outputNext[c] - outputPrev[c] ) * phase );
+        }
+        outputPhase += ratio;
+    }
+}
+
+template <typename Sample, typename Converter>
+void DSPatchables::internal::AggregateDevice::Capture( Sample const* in, unsigned int frameCount, int64_t nowNs, Converter convert )
+{
+    const size_t channelCount = inputCount;
+    const size_t fill = inputFifo.Size() / channelCount;
+
+    // produce main device frames a touch faster or slower than we capture them to hold the FIFO at its target
+    const double smoothFill = fill + blockSize * ( 1.0 - BlockProgress( nowNs ) );
+    const double ratio = inputDrift.Update( smoothFill, (double)targetFrames, (double)blockSize );
+
+    for ( size_t j = 0; j < frameCount; ++j )
+    {
+        Sample const* next = in + j * channelCount;
+        for ( size_t c = 0; c < channelCount; ++c )
+        {
+            inputNext[c] = convert( next[c] );
+        }
+
+        // linear interpolation between the previous frame and this one, at each output position in between
+        while ( inputPhase < 1.0 )
+        {
+            const float phase = (float)inputPhase;
+            for ( size_t c = 0; c < channelCount; ++c )
+            {
+                inputFrame[c] = static_cast<short>( std::lrint( inputPrev[c] + ( inputNext[c] - inputPrev[c] ) * phase ) );
+            }
+            if ( !inputFifo.Write( inputFrame.data(), channelCount ) )
+            {
+                ++overrunCount;
+            }
+            inputPhase += ratio;
+        }
+        inputPhase -= 1.0;
+
+        std::swap( inputPrev, inputNext );
+    }
 }
@@ -30,6 +30,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <DSPatch.h>
 
+#include <cstdint>
 #include <functional>
 
 namespace DSPatch
@@ -45,6 +46,33 @@ class AudioDevice;
 class DLLEXPORT AudioDevice final : public Component
 {
 public:
+    // Log2 histogram of durations: buckets[0] counts durations under 1us, buckets[i] those of 2^(i-1) to 2^i us
+    struct TimingHistogram
+    {
+        std::vector<uint64_t> buckets;
+        uint64_t count = 0;
+        uint64_t meanUs = 0;
+        uint64_t maxUs = 0;
+    };
+
+    struct TimingStats
+    {
+        TimingHistogram callbackJitter;    // distance of each callback interval from the nominal period
+        TimingHistogram callbackDuration;  // time spent in the callback
+        TimingHistogram processWait;       // time Process_() waited for room in the output queue
+        uint64_t processTimeouts = 0;      // waits that gave up after c_bufferWaitTimeoutMs
+        uint64_t inputOverflows = 0;       // RTAUDIO_INPUT_OVERFLOW reported by the driver
+        uint64_t outputUnderflows = 0;     // RTAUDIO_OUTPUT_UNDERFLOW reported by the driver
+    };
+
+    // Realtime settings for the audio thread, each applied as far as the platform and the process' permissions allow
+    struct RealtimeOptions
+    {
+        int priority = 0;         // SCHED_FIFO priority (0: leave the driver's default)
+        std::vector<int> cpus;    // cores to pin the audio thread to (empty: any)
+        bool lockMemory = false;  // mlockall() the process (audio thread stacks included)
+    };
+
     explicit AudioDevice( bool isOutputDevice = true,
                           std::vector<std::string> const& deviceNameHas = std::vector<std::string>{},
                           bool defaultIfNotFound = true,
@@ -57,6 +85,18 @@ public:
     bool SetDevice( unsigned int deviceId, bool loopback );
     bool SetDevice( bool isOutputDevice, std::vector<std::string> const& deviceNameHas, bool defaultIfNotFound, bool loopback );
 
+    // Run without sound hardware: an internal clock drives the stream, either paced to the wall clock or as
+    // fast as Process_() can keep up (inputs then read silence). Selecting a device returns to live mode.
+    void SetOfflineDevice( unsigned int inputCount, unsigned int outputCount, bool paced = true );
+    bool IsOffline() const;
+
+    // Aggregate mode: stream further devices in step with this one, each resampled to this device's clock.
+    // Their channels follow this device's, on the component's inputs (playback) and outputs (capture).
+    bool AddAggregateDevice( unsigned int deviceId );
+    void ClearAggregateDevices();
+    std::vector<unsigned int> GetAggregateDevices() const;
+    std::vector<double> GetAggregateRatios() const;  // current resampling ratio of each aggregated device
+
     bool ReloadDevices();
 
     std::string GetDeviceName( unsigned int deviceId ) const;
@@ -69,18 +109,51 @@ public:
     unsigned int GetDefaultOutputDevice() const;
     unsigned int GetCurrentDevice() const;
 
+    // Both take effect without stopping a running stream where they can. Blocks of the new size are swapped in
+    // at a block boundary (playback moves over once the graph's blocks change size; SetBufferSize() doesn't wait
+    // for that). A new rate opens a second stream on the device and crossfades over to it. Devices that only
+    // allow one stream at a time, aggregates and offline rate changes restart the stream instead.
+    // A live buffer size change keeps the driver's period, even with no period set (see SetPeriodSize()):
+    // the period (and so the latency) only follows the new buffer size once the stream restarts. Call
+    // SetPeriodSize() too to renegotiate it straight away (which restarts the stream).
     unsigned int SetBufferSize( unsigned int bufferSize );
     bool SetSampleRate( unsigned int sampleRate );
 
+    // Number of periods queued between Process_() and the sound card (1 to 8).
+    // More periods ride out longer graph stalls at the cost of added latency.
+    bool SetBufferDepth( unsigned int bufferDepth );
+    unsigned int GetBufferDepth() const;
+
     bool IsStreaming() const;
     unsigned int GetBufferSize() const;
     unsigned int GetSampleRate() const;
 
+    // The driver's period can differ from the graph's block size (GetBufferSize()): blocks are re-blocked
+    // internally. Set a small period for low latency while the graph keeps its larger blocks (0 to match the
+    // buffer size the stream opened with).
+    unsigned int SetPeriodSize( unsigned int periodSize );
+    unsigned int GetPeriodSize() const;
+
+    uint64_t GetUnderrunCount() const;
+    uint64_t GetOverrunCount() const;
+    unsigned int GetRecommendedBufferDepth() const;
+    void ResetBufferStats();
+
+    TimingStats GetTimingStats() const;
+    void ResetTimingStats();
+    void SetTimingDumpInterval( int intervalMs );  // print timing stats every intervalMs (0 to disable)
+
+    void SetRealtimeOptions( RealtimeOptions const& options );
+    RealtimeOptions GetRealtimeOptions() const;
+    RealtimeOptions GetRealtimeStatus() const;  // the options that were applied (once the stream has started)
+
     void ShowWarnings( bool enabled );
 
     virtual void Process_( SignalBus& inputs, SignalBus& outputs ) override;
 
 private:
+    bool Available_( bool deferChange );
+
     std::unique_ptr<internal::AudioDevice> p;
 };
 
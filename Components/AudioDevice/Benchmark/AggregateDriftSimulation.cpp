@@ -0,0 +1,198 @@
+/******************************************************************************
+AudioDevice Aggregate Drift Simulation
+Copyright (c) 2025, Marcus Tomlinson
+
+BSD 2-Clause License
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Runs an aggregated device's playback and capture FIFOs against a main device whose clock is off by a fixed
+// amount (+/-100 ppm by default), on a simulated clock so that every run is the same. Process_() trades a block
+// with each FIFO every main device block, and the aggregated device's callback resamples a period at a time the
+// way AggregateDevice::Playback() and Capture() do. Fails unless both FIFOs settle at their target fill, with
+// the resampling ratios matching the drift and no FIFO ever running dry or full.
+//
+// Usage: AggregateDriftSimulation [drift (ppm)] [minutes]
+
+#include <DriftCorrection.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#include <vector>
+
+using namespace DSPatch::DSPatchables::internal;
+
+namespace
+{
+
+const unsigned int c_sampleRate = 48000;
+const unsigned int c_blockSize = 256;       // (the main device's)
+const unsigned int c_periodSize = 441;      // (the aggregated device's, deliberately unrelated to the block size)
+const unsigned int c_channelCount = 2;
+const double c_settleSeconds = 60.0;         // allow the controllers a minute to pull the FIFOs in
+const double c_fillTolerance = 0.25;         // settled fill must average within a quarter block of target
+const double c_ratioTolerance = 5e-6;        // and the ratios must be within 5 ppm of the drift
+
+struct Result
+{
+    double outputFill = 0.0;  // mean fill error after settling (in blocks)
+    double inputFill = 0.0;
+    double outputRatio = 0.0;  // mean ratio after settling
+    double inputRatio = 0.0;
+    unsigned long long xruns = 0;
+};
+
+Result Simulate( double drift, double seconds )
+{
+    const size_t targetFrames = c_aggregateTargetBlocks * std::max( c_blockSize, c_periodSize );
+    const double blockSeconds = (double)c_blockSize / c_sampleRate;
+    const double periodSeconds = c_periodSize / ( c_sampleRate * ( 1.0 + drift ) );  // (on the main device's clock)
+
+    SampleFifo outputFifo;
+    SampleFifo inputFifo;
+    outputFifo.Reset( 4 * targetFrames * c_channelCount );
+    inputFifo.Reset( 4 * targetFrames * c_channelCount );
+
+    DriftController outputDrift;
+    DriftController inputDrift;
+    outputDrift.Reset();
+    inputDrift.Reset();
+
+    std::vector<short> block( c_blockSize * c_channelCount, 0 );
+    std::vector<short> frame( c_channelCount, 0 );
+    double outputPhase = 1.0;
+    double inputPhase = 0.0;
+    bool outputPrimed = false;
+    bool inputPrimed = false;
+
+    Result result;
+    size_t settledCount = 0;
+    double processTime = 0.0;
+    double callbackTime = 0.0;
+    double lastProcessTime = 0.0;
+
+    while ( callbackTime < seconds )
+    {
+        if ( processTime <= callbackTime )
+        {
+            // Process_(): a block into the playback FIFO, a block out of the capture FIFO
+            lastProcessTime = processTime;
+            if ( !outputFifo.Write( block.data(), block.size() ) )
+            {
+                ++result.xruns;
+            }
+            inputPrimed = inputPrimed || inputFifo.Size() >= targetFrames * c_channelCount;
+            if ( inputPrimed && !inputFifo.Read( block.data(), block.size() ) )
+            {
+                ++result.xruns;
+            }
+            processTime += blockSeconds;
+            continue;
+        }
+
+        // the aggregated device's callback, seeing the fill as AggregateDevice::BlockProgress() smooths it
+        const double progress = std::min( std::max( ( callbackTime - lastProcessTime ) / blockSeconds, 0.0 ), 1.0 );
+
+        const double outputFill = (double)( outputFifo.Size() / c_channelCount ) - c_blockSize * ( 1.0 - progress );
+        const double inputFill = (double)( inputFifo.Size() / c_channelCount ) + c_blockSize * ( 1.0 - progress );
+
+        outputPrimed = outputPrimed || outputFifo.Size() / c_channelCount >= targetFrames;
+        if ( outputPrimed )
+        {
+            const double ratio = outputDrift.Update( outputFill, (double)targetFrames, (double)c_blockSize );
+            for ( unsigned int j = 0; j < c_periodSize; ++j )
+            {
+                for ( ; outputPhase >= 1.0; outputPhase -= 1.0 )
+                {
+                    if ( !outputFifo.Read( frame.data(), c_channelCount ) )
+                    {
+                        ++result.xruns;
+                    }
+                }
+                outputPhase += ratio;
+            }
+        }
+
+        const double ratio = inputDrift.Update( inputFill, (double)targetFrames, (double)c_blockSize );
+        for ( unsigned int j = 0; j < c_periodSize; ++j )
+        {
+            for ( ; inputPhase < 1.0; inputPhase += ratio )
+            {
+                if ( !inputFifo.Write( frame.data(), c_channelCount ) )
+                {
+                    ++result.xruns;
+                }
+            }
+            inputPhase -= 1.0;
+        }
+
+        if ( callbackTime >= c_settleSeconds )
+        {
+            result.outputFill += ( outputFill - targetFrames ) / c_blockSize;
+            result.inputFill += ( inputFill - targetFrames ) / c_blockSize;
+            result.outputRatio += outputDrift.ratio;
+            result.inputRatio += inputDrift.ratio;
+            ++settledCount;
+        }
+        callbackTime += periodSeconds;
+    }
+
+    result.outputFill /= settledCount;
+    result.inputFill /= settledCount;
+    result.outputRatio /= settledCount;
+    result.inputRatio /= settledCount;
+    return result;
+}
+
+}  // namespace
+
+int main( int argc, char* argv[] )
+{
+    const double driftPpm = argc > 1 ? std::atof( argv[1] ) : 100.0;
+    const double minutes = argc > 2 ? std::atof( argv[2] ) : 10.0;
+
+    bool passed = true;
+    for ( double drift : { driftPpm * 1e-6, -driftPpm * 1e-6 } )
+    {
+        auto result = Simulate( drift, minutes * 60.0 );
+
+        // playback consumes the main device's frames 1 / (1 + drift) times per frame played, capture the reverse
+        const bool settled = std::abs( result.outputFill ) < c_fillTolerance && std::abs( result.inputFill ) < c_fillTolerance &&
+                             std::abs( result.outputRatio * ( 1.0 + drift ) - 1.0 ) < c_ratioTolerance &&
+                             std::abs( result.inputRatio / ( 1.0 + drift ) - 1.0 ) < c_ratioTolerance && result.xruns == 0;
+        passed = passed && settled;
+
+        std::printf( "%+.0f ppm: fill error %+.3f / %+.3f blocks, ratio %.6f / %.6f, %llu xruns: %s\n",
+                     drift * 1e6,
+                     result.outputFill,
+                     result.inputFill,
+                     result.outputRatio,
+                     result.inputRatio,
+                     result.xruns,
+                     settled ? "settled" : "FAILED" );
+    }
+
+    return passed ? 0 : 1;
+}
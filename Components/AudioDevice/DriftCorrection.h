@@ -0,0 +1,132 @@
+/******************************************************************************
+AudioDevice DSPatch Component
+Copyright (c) 2025, Marcus Tomlinson
+
+BSD 2-Clause License
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+
+#include <Constants.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace DSPatch
+{
+namespace DSPatchables
+{
+namespace internal
+{
+
+// Lock-free single-producer / single-consumer FIFO of interleaved samples, read and written in whole frames
+class SampleFifo
+{
+public:
+    // Not thread-safe: only call while neither side is using the FIFO
+    void Reset( size_t capacity )
+    {
+        samples.assign( capacity, 0 );
+        head = 0;
+        tail = 0;
+    }
+
+    size_t Size() const
+    {
+        return head.load( std::memory_order_acquire ) - tail.load( std::memory_order_acquire );
+    }
+
+    bool Write( short const* in, size_t count )
+    {
+        auto h = head.load( std::memory_order_relaxed );
+        if ( samples.size() - ( h - tail.load( std::memory_order_acquire ) ) < count )
+        {
+            return false;  // full
+        }
+        for ( size_t i = 0; i < count; ++i )
+        {
+            samples[( h + i ) % samples.size()] = in[i];
+        }
+        head.store( h + count, std::memory_order_release );
+        return true;
+    }
+
+    bool Read( short* out, size_t count )
+    {
+        auto t = tail.load( std::memory_order_relaxed );
+        if ( head.load( std::memory_order_acquire ) - t < count )
+        {
+            return false;  // empty
+        }
+        for ( size_t i = 0; i < count; ++i )
+        {
+            out[i] = samples[( t + i ) % samples.size()];
+        }
+        tail.store( t + count, std::memory_order_release );
+        return true;
+    }
+
+private:
+    std::vector<short> samples;
+
+    alignas( 64 ) std::atomic<size_t> head{ 0 };
+    alignas( 64 ) std::atomic<size_t> tail{ 0 };
+};
+
+// PI controller that steers a resampling ratio to hold a FIFO at its target fill
+class DriftController
+{
+public:
+    void Reset()
+    {
+        smoothedFill = -1.0;
+        integral = 0.0;
+        ratio = 1.0;
+    }
+
+    double Update( double fill, double target, double blockSize )
+    {
+        smoothedFill = smoothedFill < 0.0 ? fill : smoothedFill + c_aggregateSmoothing * ( fill - smoothedFill );
+
+        // error in blocks: a filling FIFO needs the consumer to speed up, and a draining one to slow down
+        const double error = ( smoothedFill - target ) / blockSize;
+        const double integralLimit = c_aggregateMaxDrift / c_aggregateKi;
+        integral = std::min( std::max( integral + error, -integralLimit ), integralLimit );
+
+        double correction = c_aggregateKp * error + c_aggregateKi * integral;
+        ratio = 1.0 + std::min( std::max( correction, -c_aggregateMaxDrift ), c_aggregateMaxDrift );
+        return ratio;
+    }
+
+    std::atomic<double> ratio = 1.0;
+
+private:
+    double smoothedFill = -1.0;
+    double integral = 0.0;
+};
+
+}  // namespace internal
+}  // namespace DSPatchables
+}  // namespace DSPatch
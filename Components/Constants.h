@@ -43,11 +43,36 @@ const int c_compressorGain = 90;  // +90db max gain
 
 // AudioDevice
 const int c_bufferWaitTimeoutMs = 500;  // Wait a max of 500ms for the sound card to respond
-const int c_syncWaitTimeoutS = 2;       // Wait a max of 2s for the Process_() method to respond
+const int c_syncPollIntervalMs = 1;     // Re-check for room in the output queue every 1ms while waiting
+const int c_bufferDepth = 2;            // Queue up to 2 blocks between Process_() and the sound card
+const unsigned int c_maxBufferDepth = 8;  // Allow up to 8 queued blocks when trading latency for safety
+const size_t c_timingBucketCount = 24;    // Time callbacks in log2 microsecond buckets up to ~8s
+const int c_deviceMonitorIntervalMs = 2000;  // Look for device changes every 2s in the background
+const size_t c_aggregateTargetBlocks = 3;      // Hold 3 blocks in each aggregated device's resampling FIFO
+const double c_aggregateSmoothing = 0.05;      // Smooth FIFO fill readings over ~20 callbacks
+const double c_aggregateKp = 1e-3;             // Drift controller proportional gain (per block of error)
+const double c_aggregateKi = 2.5e-7;           // Drift controller integral gain (critically damped with Kp)
+const double c_aggregateMaxDrift = 0.005;      // Never resample by more than 0.5%
+const int c_reconfigureTimeoutMs = 2000;        // Give a live buffer size or sample rate change 2s to take effect
+const size_t c_crossfadeFrames = 64;            // Fade over 64 frames either side of a live sample rate change
+
+// FlacWriter
+const int c_flacCompressionLevel = 5;  // 0 (fastest) to 8 (smallest)
+const int c_flacBlockSize = 4096;      // Samples per channel in each FLAC frame
+const int c_flacQueueSeconds = 3;      // Queue up to 3s of audio (however many blocks that is) for the encoder threads
+const int c_flacIntervalMs = 20;       // Re-check for work every 20ms in case an encoder thread missed a wakeup
+const int c_flacMaxPartitionOrder = 6;  // Split residuals into up to 64 Rice partitions
 
 // Sockets
-const int c_period = ceil( ( float( c_bufferSize ) / float( c_sampleRate ) ) * 1000.0f );
-const int c_doublePeriod = c_period * 2;
+const int c_socketDefaultPort = 8000;    // SocketOut listens on (and SocketIn connects to) localhost:8000 by default
+const int c_reconnectIntervalMs = 1000;  // Try to reconnect a dropped SocketIn once a second
+const int c_socketPollIntervalMs = 50;   // Network threads wake at least every 50ms (Process_() wakes them sooner)
+const int c_socketQueueDepth = 16;       // Queue up to 16 blocks (~160ms in flight) between Process_() and the network thread
+const int c_jitterCapacity = 32;         // Hold up to 32 blocks (~320ms) in SocketIn's jitter buffer
+const int c_jitterWindow = 64;           // Measure arrival jitter over the last 64 blocks
+const double c_jitterPercentile = 0.95;  // Buffer enough to cover 95% of the arrival jitter
+const int c_concealRepeatBlocks = 3;     // Fade a repeated block out over 3 missing blocks
+const int c_concealFadeInFrames = 64;    // Fade back in over 64 frames after a concealed block
 
 // VoxRemover
 const float c_pi = 3.1415926535897932384626433832795f;
@@ -55,6 +80,15 @@ const float c_twoPi = c_pi * 2.0f;
 const float c_s2fCoeff = 1.0f / 32767.0f;
 const float c_f2sCoeff = 32767.0f * 0.85f;
 
+// WaveReader
+const size_t c_waveCacheBudget = 256 * 1024 * 1024;  // Keep up to 256MB of decoded files cached between readers
+
 // WaveWriter
 const int c_channelCount = 2;
 const int c_bitsPerSample = 16;
+const int c_writeBufferSize = 64 * 1024;  // Buffer up to 64KB of samples between file writes
+const int c_writeAlignment = 4096;        // Write to file in whole 4KB blocks
+const int c_writeQueueDepth = 256;        // Queue up to 256 buffers (~2.5s) for the disk thread
+const int c_writeIntervalMs = 20;         // Wake the disk thread every 20ms to drain the queue
+const int c_headerIntervalMs = 1000;      // Rewrite the chunk sizes every second while recording
+const int c_ds64Size = 28;                // Size of the ds64 chunk an RF64 file needs (no table entries)
@@ -0,0 +1,870 @@
+/******************************************************************************
+FlacWriter DSPatch Component
+Copyright (c) 2025, Marcus Tomlinson
+
+BSD 2-Clause License
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include <FlacWriter.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace DSPatch;
+using namespace DSPatchables;
+
+namespace DSPatch
+{
+namespace DSPatchables
+{
+namespace internal
+{
+
+// MSB-first bit packer for FLAC frames
+class BitWriter
+{
+public:
+    void Reset()
+    {
+        bytes.clear();
+        cache = 0;
+        cacheBits = 0;
+    }
+
+    void Write( uint32_t value, int bits )
+    {
+        if ( bits == 0 )
+        {
+            return;
+        }
+
+        cache = ( cache << bits ) | ( value & ( 0xFFFFFFFFu >> ( 32 - bits ) ) );
+        cacheBits += bits;
+        while ( cacheBits >= 8 )
+        {
+            cacheBits -= 8;
+            bytes.push_back( static_cast<uint8_t>( cache >> cacheBits ) );
+        }
+    }
+
+    void WriteRice( int32_t residual, int parameter )
+    {
+        uint32_t folded = ( static_cast<uint32_t>( residual ) << 1 ) ^ static_cast<uint32_t>( residual >> 31 );
+        uint32_t quotient = folded >> parameter;
+
+        while ( quotient >= 32 )
+        {
+            Write( 0, 32 );
+            quotient -= 32;
+        }
+        Write( 1, quotient + 1 );  // unary quotient
+        Write( folded, parameter );
+    }
+
+    void WriteUtf8( uint32_t value )
+    {
+        if ( value < 0x80 )
+        {
+            Write( value, 8 );
+            return;
+        }
+
+        int extraBytes = value < 0x800 ? 1 : value < 0x10000 ? 2 : value < 0x200000 ? 3 : value < 0x4000000 ? 4 : 5;
+        Write( ( 0xFF00u >> ( extraBytes + 1 ) ) | ( value >> ( 6 * extraBytes ) ), 8 );
+        for ( int i = extraBytes - 1; i >= 0; --i )
+        {
+            Write( 0x80 | ( ( value >> ( 6 * i ) ) & 0x3F ), 8 );
+        }
+    }
+
+    void Align()
+    {
+        if ( cacheBits != 0 )
+        {
+            Write( 0, 8 - cacheBits );
+        }
+    }
+
+    std::vector<uint8_t> bytes;
+
+private:
+    uint64_t cache = 0;
+    int cacheBits = 0;
+};
+
+// Incremental MD5 (RFC 1321), for the STREAMINFO signature of the decoded audio
+class Md5
+{
+public:
+    void Update( uint8_t const* data, size_t size )
+    {
+        while ( size != 0 )
+        {
+            size_t count = std::min( size, sizeof( block ) - blockSize );
+            std::copy( data, data + count, block + blockSize );
+            blockSize += count;
+            length += count;
+            data += count;
+            size -= count;
+
+            if ( blockSize == sizeof( block ) )
+            {
+                Transform();
+                blockSize = 0;
+            }
+        }
+    }
+
+    void Final( uint8_t digest[16] )
+    {
+        uint64_t bitLength = length * 8;
+        uint8_t padding[72] = { 0x80 };
+        size_t padSize = blockSize < 56 ? 56 - blockSize : 120 - blockSize;
+        for ( int i = 0; i < 8; ++i )
+        {
+            padding[padSize + i] = static_cast<uint8_t>( bitLength >> ( 8 * i ) );
+        }
+        Update( padding, padSize + 8 );
+
+        for ( int i = 0; i < 16; ++i )
+        {
+            digest[i] = static_cast<uint8_t>( state[i / 4] >> ( 8 * ( i % 4 ) ) );
+        }
+    }
+
+private:
+    void Transform()
+    {
+        static const uint32_t k[64] = {
+            0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+            0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+            0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+            0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+            0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+            0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+            0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+            0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391 };
+        static const int shifts[4][4] = { { 7, 12, 17, 22 }, { 5, 9, 14, 20 }, { 4, 11, 16, 23 }, { 6, 10, 15, 21 } };
+
+        uint32_t words[16];
+        for ( int i = 0; i < 16; ++i )
+        {
+            words[i] = uint32_t( block[i * 4] ) | uint32_t( block[i * 4 + 1] ) << 8 | uint32_t( block[i * 4 + 2] ) << 16 |
+                       uint32_t( block[i * 4 + 3] ) << 24;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        for ( int i = 0; i < 64; ++i )
+        {
+            uint32_t f;
+            int g;
+            switch ( i / 16 )
+            {
+                case 0:
+                    f = ( b & c ) | ( ~b & d );
+                    g = i;
+                    break;
+                case 1:
+                    f = ( d & b ) | ( ~d & c );
+                    g = ( 5 * i + 1 ) % 16;
+                    break;
+                case 2:
+                    f = b ^ c ^ d;
+                    g = ( 3 * i + 5 ) % 16;
+                    break;
+                default:
+                    f = c ^ ( b | ~d );
+                    g = ( 7 * i ) % 16;
+                    break;
+            }
+
+            uint32_t sum = a + f + k[i] + words[g];
+            int shift = shifts[i / 16][i % 4];
+            a = d;
+            d = c;
+            c = b;
+            b += ( sum << shift ) | ( sum >> ( 32 - shift ) );
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+    }
+
+    uint32_t state[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    uint8_t block[64] = {};
+    size_t blockSize = 0;
+    uint64_t length = 0;
+};
+
+// A block of samples on its way from the tick thread, through an encoder thread, to the disk thread
+struct FlacJob
+{
+    enum State
+    {
+        Free,
+        Filled,
+        Encoding,
+        Encoded
+    };
+
+    std::atomic<int> state = Free;
+    uint32_t frameNumber = 0;
+    int frameCount = 0;
+    std::vector<int32_t> samples;  // one block per channel
+    BitWriter frame;
+};
+
+// Per encoder thread scratch space
+class FlacEncoder
+{
+public:
+    FlacEncoder( int blockSize )
+        : folded( blockSize )
+        , mid( blockSize )
+        , side( blockSize )
+    {
+    }
+
+    // How a subframe is to be coded
+    struct Subframe
+    {
+        enum Type
+        {
+            Constant,
+            Verbatim,
+            Fixed
+        };
+
+        Type type = Verbatim;
+        int order = 0;
+        int partitionOrder = 0;
+        int parameters[1 << c_flacMaxPartitionOrder] = {};
+        uint64_t bits = 0;
+    };
+
+    void Encode( FlacJob& job, int channelCount, int compressionLevel );
+
+private:
+    Subframe Plan( int32_t const* samples, int count, int bitsPerSample, int compressionLevel );
+    void Write( BitWriter& out, Subframe const& subframe, int32_t const* samples, int count, int bitsPerSample );
+
+    std::vector<uint32_t> folded;
+    std::vector<int32_t> mid;
+    std::vector<int32_t> side;
+};
+
+class FlacWriter
+{
+public:
+    FlacWriter( std::string const& fileName, int channelCount, int sampleRate, int compressionLevel, int blockSize )
+        : file( fileName, std::ios::binary )
+        , channelCount( channelCount )
+        , sampleRate( sampleRate )
+        , blockSize( std::min( std::max( blockSize, 16 ), 65535 ) )
+        , compressionLevel( compressionLevel )
+        , jobs( std::max<size_t>( ( size_t( c_flacQueueSeconds ) * sampleRate + this->blockSize - 1 ) / this->blockSize, 4 ) )
+    {
+        md5Samples.reserve( this->blockSize * channelCount * 2 );
+        for ( auto& job : jobs )
+        {
+            job.samples.resize( this->blockSize * channelCount );
+            job.frame.bytes.reserve( this->blockSize * channelCount * 3 + 32 );  // (worst case verbatim side channels)
+        }
+
+        if ( !file.is_open() )
+        {
+            std::cerr << "'" << fileName << "' could not be opened for writing." << std::endl;
+        }
+    }
+
+    void WriteStreamInfo();
+    void Encode( FlacEncoder& encoder );
+    void Run();
+
+    std::ofstream file;
+    int channelCount;
+    int sampleRate;
+    int blockSize;
+    std::atomic<int> compressionLevel;
+
+    std::vector<FlacJob> jobs;
+
+    // tick thread only
+    size_t fillIndex = 0;
+    uint32_t frameNumber = 0;
+
+    // encoder threads (under workMutex)
+    size_t encodeIndex = 0;
+
+    // disk thread only
+    size_t writeIndex = 0;
+    uint64_t totalSamples = 0;
+    uint32_t minFrameSize = 0xFFFFFF;
+    uint32_t maxFrameSize = 0;
+    Md5 md5;
+    std::vector<uint8_t> md5Samples;  // (a block's samples, interleaved as the decoder will output them)
+
+    std::vector<std::thread> encoders;
+    std::thread writer;
+    std::atomic<bool> stopping = false;
+    std::mutex workMutex;
+    std::condition_variable encodeCondt;
+    std::condition_variable writeCondt;
+
+    std::atomic<uint64_t> bytesWritten = 0;
+    std::atomic<uint64_t> overflowCount = 0;
+};
+
+}  // namespace internal
+}  // namespace DSPatchables
+}  // namespace DSPatch
+
+// Prediction error of the FLAC fixed polynomial predictor of the given order
+static inline int32_t fixed_residual( int32_t const* samples, int i, int order )
+{
+    switch ( order )
+    {
+        case 1:
+            return samples[i] - samples[i - 1];
+        case 2:
+            return samples[i] - 2 * samples[i - 1] + samples[i - 2];
+        case 3:
+            return samples[i] - 3 * samples[i - 1] + 3 * samples[i - 2] - samples[i - 3];
+        case 4:
+            return samples[i] - 4 * samples[i - 1] + 6 * samples[i - 2] - 4 * samples[i - 3] + samples[i - 4];
+        default:
+            return samples[i];
+    }
+}
+
+static uint8_t crc8( uint8_t const* data, size_t size )
+{
+    uint8_t crc = 0;
+    while ( size-- )
+    {
+        crc ^= *data++;
+        for ( int i = 0; i < 8; ++i )
+        {
+            crc = crc & 0x80 ? static_cast<uint8_t>( ( crc << 1 ) ^ 0x07 ) : static_cast<uint8_t>( crc << 1 );
+        }
+    }
+    return crc;
+}
+
+static uint16_t crc16( uint8_t const* data, size_t size )
+{
+    static auto const table = []() {
+        std::vector<uint16_t> t( 256 );
+        for ( int i = 0; i < 256; ++i )
+        {
+            uint16_t crc = static_cast<uint16_t>( i << 8 );
+            for ( int j = 0; j < 8; ++j )
+            {
+                crc = crc & 0x8000 ? static_cast<uint16_t>( ( crc << 1 ) ^ 0x8005 ) : static_cast<uint16_t>( crc << 1 );
+            }
+            t[i] = crc;
+        }
+        return t;
+    }();
+
+    uint16_t crc = 0;
+    while ( size-- )
+    {
+        crc = static_cast<uint16_t>( ( crc << 8 ) ^ table[( crc >> 8 ) ^ *data++] );
+    }
+    return crc;
+}
+
+FlacWriter::FlacWriter( std::string const& fileName, int channelCount, int sampleRate, int compressionLevel, int blockSize )
+    : p( new internal::FlacWriter( fileName, channelCount, sampleRate, compressionLevel, blockSize ) )
+{
+    SetInputCount_( channelCount );
+
+    p->WriteStreamInfo();
+
+    // Encode on a pool of worker threads, and hand all file writes to a disk thread
+    auto encoderCount = std::max( 1u, std::min( std::thread::hardware_concurrency() / 2, 4u ) );
+    for ( unsigned int i = 0; i < encoderCount; ++i )
+    {
+        p->encoders.emplace_back( [this]() {
+            internal::FlacEncoder encoder( p->blockSize );
+            p->Encode( encoder );
+        } );
+    }
+    p->writer = std::thread( &internal::FlacWriter::Run, p.get() );
+}
+
+FlacWriter::~FlacWriter()
+{
+    // Hand over the last (partial) block
+    auto& job = p->jobs[p->fillIndex];
+    if ( job.state == internal::FlacJob::Free && job.frameCount != 0 )
+    {
+        job.frameNumber = p->frameNumber;
+        job.state = internal::FlacJob::Filled;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( p->workMutex );
+        p->stopping = true;
+    }
+    p->encodeCondt.notify_all();
+    p->writeCondt.notify_all();
+    for ( auto& encoder : p->encoders )
+    {
+        encoder.join();
+    }
+    p->writer.join();
+
+    // Fill in the stream details we only know now
+    p->WriteStreamInfo();
+}
+
+void FlacWriter::SetCompressionLevel( int compressionLevel )
+{
+    p->compressionLevel = compressionLevel;
+}
+
+int FlacWriter::GetCompressionLevel() const
+{
+    return p->compressionLevel;
+}
+
+uint64_t FlacWriter::GetBytesWritten() const
+{
+    return p->bytesWritten;
+}
+
+uint64_t FlacWriter::GetOverflowCount() const
+{
+    return p->overflowCount;
+}
+
+void FlacWriter::Process_( SignalBus& inputs, SignalBus& )
+{
+    std::vector<short>* in0 = inputs.GetValue<std::vector<short>>( 0 );
+    if ( !in0 )
+    {
+        return;  // input buffer missing
+    }
+
+    for ( int i = 1; i < p->channelCount; ++i )
+    {
+        auto in = inputs.GetValue<std::vector<short>>( i );
+
+        if ( !in )
+        {
+            return;  // input buffer missing
+        }
+        else if ( in->size() != in0->size() )
+        {
+            return;  // input buffers are not the same size
+        }
+    }
+
+    // copy input into blocks, handing each block to the encoders once it is full
+    const int frameCount = (int)in0->size();
+    for ( int offset = 0; offset < frameCount; )
+    {
+        auto& job = p->jobs[p->fillIndex];
+        if ( job.state != internal::FlacJob::Free )
+        {
+            ++p->overflowCount;  // the encoders have fallen behind, drop the rest of this buffer
+            return;
+        }
+
+        int count = std::min( frameCount - offset, p->blockSize - job.frameCount );
+        for ( int i = 0; i < p->channelCount; ++i )
+        {
+            auto in = inputs.GetValue<std::vector<short>>( i )->data() + offset;
+            std::copy( in, in + count, job.samples.data() + i * p->blockSize + job.frameCount );
+        }
+        job.frameCount += count;
+        offset += count;
+
+        if ( job.frameCount == p->blockSize )
+        {
+            job.frameNumber = p->frameNumber++;
+            job.state = internal::FlacJob::Filled;
+            p->fillIndex = ( p->fillIndex + 1 ) % p->jobs.size();
+            p->encodeCondt.notify_one();  // (without workMutex, so the tick thread never blocks on it)
+        }
+    }
+}
+
+void DSPatchables::internal::FlacWriter::WriteStreamInfo()
+{
+    BitWriter header;
+    header.Write( 'f', 8 );
+    header.Write( 'L', 8 );
+    header.Write( 'a', 8 );
+    header.Write( 'C', 8 );
+
+    header.Write( 1, 1 );   // last metadata block
+    header.Write( 0, 7 );   // STREAMINFO
+    header.Write( 34, 24 );  // block length
+
+    header.Write( blockSize, 16 );  // min block size
+    header.Write( blockSize, 16 );  // max block size
+    header.Write( maxFrameSize == 0 ? 0 : minFrameSize, 24 );
+    header.Write( maxFrameSize, 24 );
+    header.Write( sampleRate, 20 );
+    header.Write( channelCount - 1, 3 );
+    header.Write( 16 - 1, 5 );  // bits per sample
+    header.Write( static_cast<uint32_t>( totalSamples >> 32 ), 4 );
+    header.Write( static_cast<uint32_t>( totalSamples ), 32 );
+
+    // MD5 signature (only once the stream is complete, all zeros meaning "not computed" until then)
+    uint8_t digest[16] = {};
+    if ( stopping )
+    {
+        md5.Final( digest );
+    }
+    for ( auto byte : digest )
+    {
+        header.Write( byte, 8 );
+    }
+
+    file.seekp( 0 );
+    file.write( reinterpret_cast<char const*>( header.bytes.data() ), header.bytes.size() );
+}
+
+void DSPatchables::internal::FlacWriter::Encode( FlacEncoder& encoder )
+{
+    std::unique_lock<std::mutex> lock( workMutex );
+    while ( true )
+    {
+        bool stop = stopping;
+
+        // claim the next filled block (blocks are filled in order, so if this one isn't, none are)
+        auto& job = jobs[encodeIndex];
+        if ( job.state == FlacJob::Filled )
+        {
+            job.state = FlacJob::Encoding;
+            encodeIndex = ( encodeIndex + 1 ) % jobs.size();
+
+            lock.unlock();
+            encoder.Encode( job, channelCount, compressionLevel );
+            lock.lock();
+
+            job.state = FlacJob::Encoded;
+            writeCondt.notify_one();
+            continue;
+        }
+
+        if ( stop )
+        {
+            break;
+        }
+
+        // the tick thread notifies without workMutex, so a wakeup can slip in before we wait: re-check now and then
+        encodeCondt.wait_for( lock, std::chrono::milliseconds( c_flacIntervalMs ) );
+    }
+}
+
+void DSPatchables::internal::FlacWriter::Run()
+{
+    std::unique_lock<std::mutex> lock( workMutex );
+    while ( true )
+    {
+        bool stop = stopping;
+
+        // write encoded frames in order
+        auto& job = jobs[writeIndex];
+        if ( job.state == FlacJob::Encoded )
+        {
+            lock.unlock();
+
+            // hash the block's samples as interleaved 16-bit little-endian, as FLAC's signature requires
+            md5Samples.resize( job.frameCount * channelCount * 2 );
+            for ( int i = 0; i < job.frameCount; ++i )
+            {
+                for ( int c = 0; c < channelCount; ++c )
+                {
+                    auto sample = static_cast<uint16_t>( job.samples[c * blockSize + i] );
+                    md5Samples[( i * channelCount + c ) * 2] = static_cast<uint8_t>( sample );
+                    md5Samples[( i * channelCount + c ) * 2 + 1] = static_cast<uint8_t>( sample >> 8 );
+                }
+            }
+            md5.Update( md5Samples.data(), md5Samples.size() );
+
+            auto const& bytes = job.frame.bytes;
+            file.write( reinterpret_cast<char const*>( bytes.data() ), bytes.size() );
+
+            totalSamples += job.frameCount;
+            minFrameSize = std::min( minFrameSize, (uint32_t)bytes.size() );
+            maxFrameSize = std::max( maxFrameSize, (uint32_t)bytes.size() );
+            bytesWritten += bytes.size();
+
+            job.frameCount = 0;
+            job.state = FlacJob::Free;
+            writeIndex = ( writeIndex + 1 ) % jobs.size();
+
+            lock.lock();
+            continue;
+        }
+
+        if ( stop && job.state == FlacJob::Free )
+        {
+            break;  // (the tick thread has stopped, so nothing else is coming)
+        }
+        writeCondt.wait( lock );
+    }
+}
+
+void DSPatchables::internal::FlacEncoder::Encode( FlacJob& job, int channelCount, int compressionLevel )
+{
+    const int count = job.frameCount;
+    const int blockSize = (int)job.samples.size() / channelCount;
+    auto channel = [&]( int i ) { return job.samples.data() + i * blockSize; };
+
+    // pick the cheapest stereo decorrelation (levels 2 and up)
+    int assignment = channelCount - 1;  // independent channels
+    Subframe subframes[2];
+    int32_t const* sources[2] = { channel( 0 ), channelCount > 1 ? channel( 1 ) : nullptr };
+    int bits[2] = { 16, 16 };
+
+    if ( channelCount == 2 && compressionLevel >= 2 )
+    {
+        auto left = channel( 0 );
+        auto right = channel( 1 );
+        for ( int i = 0; i < count; ++i )
+        {
+            mid[i] = ( left[i] + right[i] ) >> 1;
+            side[i] = left[i] - right[i];
+        }
+
+        auto l = Plan( left, count, 16, compressionLevel );
+        auto r = Plan( right, count, 16, compressionLevel );
+        auto m = Plan( mid.data(), count, 16, compressionLevel );
+        auto s = Plan( side.data(), count, 17, compressionLevel );
+
+        uint64_t costs[4] = { l.bits + r.bits, l.bits + s.bits, s.bits + r.bits, m.bits + s.bits };
+        int best = (int)( std::min_element( costs, costs + 4 ) - costs );
+
+        Subframe const* plans[4][2] = { { &l, &r }, { &l, &s }, { &s, &r }, { &m, &s } };
+        int32_t const* data[4][2] = { { left, right }, { left, side.data() }, { side.data(), right }, { mid.data(), side.data() } };
+        int widths[4][2] = { { 16, 16 }, { 16, 17 }, { 17, 16 }, { 16, 17 } };
+
+        assignment = best == 0 ? 1 : 7 + best;  // (8: left/side, 9: side/right, 10: mid/side)
+        for ( int i = 0; i < 2; ++i )
+        {
+            subframes[i] = *plans[best][i];
+            sources[i] = data[best][i];
+            bits[i] = widths[best][i];
+        }
+    }
+
+    // frame header
+    auto& out = job.frame;
+    out.Reset();
+    out.Write( 0x3FFE, 14 );  // sync code
+    out.Write( 0, 1 );        // reserved
+    out.Write( 0, 1 );        // fixed block size stream
+    out.Write( 7, 4 );        // block size: 16 bit (size - 1) at the end of the header
+    out.Write( 0, 4 );        // sample rate: from STREAMINFO
+    out.Write( assignment, 4 );
+    out.Write( 4, 3 );  // 16 bits per sample
+    out.Write( 0, 1 );  // reserved
+    out.WriteUtf8( job.frameNumber );
+    out.Write( count - 1, 16 );
+    out.Write( crc8( out.bytes.data(), out.bytes.size() ), 8 );
+
+    // subframes
+    for ( int i = 0; i < channelCount; ++i )
+    {
+        if ( channelCount == 2 && compressionLevel >= 2 )
+        {
+            Write( out, subframes[i], sources[i], count, bits[i] );
+        }
+        else
+        {
+            Write( out, Plan( channel( i ), count, 16, compressionLevel ), channel( i ), count, 16 );
+        }
+    }
+
+    // frame footer
+    out.Align();
+    auto crc = crc16( out.bytes.data(), out.bytes.size() );
+    out.Write( crc, 16 );
+}
+
+DSPatchables::internal::FlacEncoder::Subframe
+    DSPatchables::internal::FlacEncoder::Plan( int32_t const* samples, int count, int bitsPerSample, int compressionLevel )
+{
+    Subframe plan;
+    plan.type = Subframe::Verbatim;
+    plan.bits = 8 + (uint64_t)count * bitsPerSample;
+
+    if ( std::all_of( samples, samples + count, [samples]( int32_t sample ) { return sample == samples[0]; } ) )
+    {
+        plan.type = Subframe::Constant;
+        plan.bits = 8 + bitsPerSample;
+        return plan;
+    }
+
+    // pick the fixed predictor order with the smallest total residual (higher levels try higher orders)
+    const int maxOrder = std::min( { compressionLevel <= 1 ? 2 : 4, count - 1, 4 } );
+    int order = 0;
+    uint64_t bestSum = UINT64_MAX;
+    for ( int o = 0; o <= maxOrder; ++o )
+    {
+        uint64_t sum = 0;
+        for ( int i = maxOrder; i < count; ++i )
+        {
+            sum += (uint64_t)std::abs( fixed_residual( samples, i, o ) );
+        }
+        if ( sum < bestSum )
+        {
+            bestSum = sum;
+            order = o;
+        }
+    }
+
+    // fold the residual to unsigned Rice input
+    for ( int i = order; i < count; ++i )
+    {
+        int32_t e = fixed_residual( samples, i, order );
+        folded[i] = ( static_cast<uint32_t>( e ) << 1 ) ^ static_cast<uint32_t>( e >> 31 );
+    }
+
+    // pick the Rice partitioning with the fewest bits (higher levels try finer partitions)
+    const int maxPartitionOrder = compressionLevel <= 1 ? 0 : compressionLevel <= 4 ? 3 : c_flacMaxPartitionOrder;
+
+    Subframe fixed;
+    fixed.type = Subframe::Fixed;
+    fixed.order = order;
+    fixed.bits = UINT64_MAX;
+
+    for ( int po = 0; po <= maxPartitionOrder; ++po )
+    {
+        const int partitions = 1 << po;
+        const int partitionSize = count >> po;
+        if ( count % partitions != 0 || partitionSize <= order )
+        {
+            break;
+        }
+
+        Subframe candidate = fixed;
+        candidate.partitionOrder = po;
+        candidate.bits = 8 + (uint64_t)order * bitsPerSample + 6;
+
+        for ( int p = 0; p < partitions; ++p )
+        {
+            const int begin = p == 0 ? order : p * partitionSize;
+            const int end = ( p + 1 ) * partitionSize;
+            const int n = end - begin;
+
+            uint64_t sum = 0;
+            for ( int i = begin; i < end; ++i )
+            {
+                sum += folded[i];
+            }
+
+            // estimate the parameter from the mean, then check its neighbours exactly
+            int k = 0;
+            while ( k < 14 && ( (uint64_t)n << ( k + 1 ) ) <= sum )
+            {
+                ++k;
+            }
+
+            uint64_t bestBits = UINT64_MAX;
+            int bestK = k;
+            for ( int tryK = std::max( 0, k - 1 ); tryK <= std::min( 14, k + 1 ); ++tryK )
+            {
+                uint64_t partitionBits = (uint64_t)n * ( tryK + 1 );
+                for ( int i = begin; i < end; ++i )
+                {
+                    partitionBits += folded[i] >> tryK;
+                }
+                if ( partitionBits < bestBits )
+                {
+                    bestBits = partitionBits;
+                    bestK = tryK;
+                }
+            }
+
+            candidate.parameters[p] = bestK;
+            candidate.bits += 4 + bestBits;
+        }
+
+        if ( candidate.bits < fixed.bits )
+        {
+            fixed = candidate;
+        }
+    }
+
+    return fixed.bits < plan.bits ? fixed : plan;
+}
+
+void DSPatchables::internal::FlacEncoder::Write(
+    BitWriter& out, Subframe const& subframe, int32_t const* samples, int count, int bitsPerSample )
+{
+    if ( subframe.type == Subframe::Constant )
+    {
+        out.Write( 0, 8 );  // (zero pad, type 000000, no wasted bits)
+        out.Write( samples[0], bitsPerSample );
+    }
+    else if ( subframe.type == Subframe::Verbatim )
+    {
+        out.Write( 1 << 1, 8 );  // (zero pad, type 000001, no wasted bits)
+        for ( int i = 0; i < count; ++i )
+        {
+            out.Write( samples[i], bitsPerSample );
+        }
+    }
+    else
+    {
+        out.Write( ( 8 | subframe.order ) << 1, 8 );  // (zero pad, type 001xxx, no wasted bits)
+        for ( int i = 0; i < subframe.order; ++i )
+        {
+            out.Write( samples[i], bitsPerSample );  // warm-up samples
+        }
+
+        out.Write( 0, 2 );  // Rice coding, 4 bit parameters
+        out.Write( subframe.partitionOrder, 4 );
+
+        const int partitions = 1 << subframe.partitionOrder;
+        const int partitionSize = count >> subframe.partitionOrder;
+        for ( int p = 0; p < partitions; ++p )
+        {
+            const int parameter = subframe.parameters[p];
+            out.Write( parameter, 4 );
+
+            const int end = ( p + 1 ) * partitionSize;
+            for ( int i = p == 0 ? subframe.order : p * partitionSize; i < end; ++i )
+            {
+                out.WriteRice( fixed_residual( samples, i, subframe.order ), parameter );
+            }
+        }
+    }
+}
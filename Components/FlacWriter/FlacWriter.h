@@ -0,0 +1,72 @@
+/******************************************************************************
+FlacWriter DSPatch Component
+Copyright (c) 2025, Marcus Tomlinson
+
+BSD 2-Clause License
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+
+#include <Constants.h>
+#include <DSPatch.h>
+
+#include <cstdint>
+
+namespace DSPatch
+{
+namespace DSPatchables
+{
+
+namespace internal
+{
+class FlacWriter;
+}
+
+class DLLEXPORT FlacWriter final : public Component
+{
+public:
+    FlacWriter( std::string const& fileName,
+                int channelCount,
+                int sampleRate,
+                int compressionLevel = c_flacCompressionLevel,
+                int blockSize = c_flacBlockSize );
+    virtual ~FlacWriter();
+
+    void SetCompressionLevel( int compressionLevel );
+    int GetCompressionLevel() const;
+
+    uint64_t GetBytesWritten() const;
+    uint64_t GetOverflowCount() const;
+
+protected:
+    virtual void Process_( SignalBus& inputs, SignalBus& outputs ) override;
+
+private:
+    std::unique_ptr<internal::FlacWriter> p;
+};
+
+EXPORT_PLUGIN( FlacWriter, "FlacWriter.flac", c_channelCount, c_sampleRate )
+
+}  // namespace DSPatchables
+}  // namespace DSPatch
@@ -0,0 +1,119 @@
+/******************************************************************************
+DSPatchables - DSPatch Component Repository
+Copyright (c) 2025, Marcus Tomlinson
+
+BSD 2-Clause License
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace DSPatch
+{
+namespace DSPatchables
+{
+namespace internal
+{
+
+// Wait-free single-producer / single-consumer queue of preallocated slots.
+// The producer fills WriteSlot() and publishes it with Push(), the consumer reads ReadSlot() and releases it with Pop().
+template <typename T>
+class RingBuffer
+{
+public:
+    explicit RingBuffer( size_t capacity = 0 )
+        : slots( capacity )
+    {
+    }
+
+    // Not thread-safe: only call while neither side is using the buffer
+    void Reset( size_t capacity )
+    {
+        slots.resize( capacity );
+        head = 0;
+        tail = 0;
+    }
+
+    // Not thread-safe: used to preallocate the slots before either side starts
+    std::vector<T>& Slots()
+    {
+        return slots;
+    }
+
+    size_t Capacity() const
+    {
+        return slots.size();
+    }
+
+    size_t Size() const
+    {
+        // load tail first: head only ever moves ahead of it, so the difference can't wrap below zero
+        const size_t t = tail.load( std::memory_order_acquire );
+        return head.load( std::memory_order_acquire ) - t;
+    }
+
+    T* WriteSlot()
+    {
+        auto h = head.load( std::memory_order_relaxed );
+        if ( h - tail.load( std::memory_order_acquire ) == slots.size() )
+        {
+            return nullptr;  // full
+        }
+        return &slots[h % slots.size()];
+    }
+
+    void Push()
+    {
+        head.store( head.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+    }
+
+    T* ReadSlot()
+    {
+        auto t = tail.load( std::memory_order_relaxed );
+        if ( head.load( std::memory_order_acquire ) == t )
+        {
+            return nullptr;  // empty
+        }
+        return &slots[t % slots.size()];
+    }
+
+    void Pop()
+    {
+        tail.store( tail.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+    }
+
+private:
+    std::vector<T> slots;
+
+    // keep the producer and consumer counters on separate cache lines
+    alignas( 64 ) std::atomic<size_t> head{ 0 };
+    alignas( 64 ) std::atomic<size_t> tail{ 0 };
+};
+
+}  // namespace internal
+}  // namespace DSPatchables
+}  // namespace DSPatch
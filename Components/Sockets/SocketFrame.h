@@ -0,0 +1,124 @@
+/******************************************************************************
+Sockets DSPatch Components
+Copyright (c) 2025, Marcus Tomlinson
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace DSPatch
+{
+namespace DSPatchables
+{
+namespace internal
+{
+
+// SocketOut streams binary websocket messages, one frame per block: this header, followed by each channel's
+// samples in turn. Fields are little-endian.
+//
+//   bytes 0-3    sequence number (counts every block SocketOut is given, so a gap means blocks were dropped)
+//   bytes 4-11   timestamp: when SocketOut was given the block (microseconds on the sender's steady clock)
+//   bytes 12-13  channel count (C)
+//   C x 2 bytes  each channel's frame count (0 for a channel that had no buffer this block)
+//
+// All of a SocketOut's channels share one frame, and so one message and one connection. Channels needn't carry
+// the same signal or block size: each is an independent stream that happens to be sent alongside the others.
+//
+// Flow control is credit-based: SocketOut only sends a client as many frames as it has been granted. A client
+// grants more by sending a 4 byte message (the number of frames, little-endian), or exactly one frame by sending
+// an empty message (so a simple client can just request one block at a time).
+
+struct FrameHeader
+{
+    uint32_t sequence = 0;
+    uint64_t timestampUs = 0;
+    uint16_t channelCount = 0;
+};
+
+const size_t c_frameHeaderSize = 14;       // (not counting the channel frame counts)
+const size_t c_maxChannelFrames = 0xFFFF;  // (the most a channel's 2 byte frame count can describe)
+const size_t c_creditSize = 4;
+
+inline void WriteLittleEndian( char* data, uint64_t value, size_t size )
+{
+    for ( size_t i = 0; i < size; ++i )
+    {
+        data[i] = char( ( value >> ( 8 * i ) ) & 0xFF );
+    }
+}
+
+inline uint64_t ReadLittleEndian( char const* data, size_t size )
+{
+    uint64_t value = 0;
+    for ( size_t i = 0; i < size; ++i )
+    {
+        value |= uint64_t( uint8_t( data[i] ) ) << ( 8 * i );
+    }
+    return value;
+}
+
+// Where the samples start in a frame of channelCount channels
+inline size_t FrameDataOffset( size_t channelCount )
+{
+    return c_frameHeaderSize + 2 * channelCount;
+}
+
+inline void WriteFrameHeader( char* frame, FrameHeader const& header )
+{
+    WriteLittleEndian( frame, header.sequence, 4 );
+    WriteLittleEndian( frame + 4, header.timestampUs, 8 );
+    WriteLittleEndian( frame + 12, header.channelCount, 2 );
+}
+
+inline void WriteChannelFrameCount( char* frame, size_t channel, uint16_t frameCount )
+{
+    WriteLittleEndian( frame + c_frameHeaderSize + 2 * channel, frameCount, 2 );
+}
+
+inline bool ReadFrameHeader( char const* frame, size_t length, FrameHeader& header )
+{
+    if ( length < c_frameHeaderSize )
+    {
+        return false;
+    }
+
+    header.sequence = uint32_t( ReadLittleEndian( frame, 4 ) );
+    header.timestampUs = ReadLittleEndian( frame + 4, 8 );
+    header.channelCount = uint16_t( ReadLittleEndian( frame + 12, 2 ) );
+    return length >= FrameDataOffset( header.channelCount );
+}
+
+inline uint16_t ReadChannelFrameCount( char const* frame, size_t channel )
+{
+    return uint16_t( ReadLittleEndian( frame + c_frameHeaderSize + 2 * channel, 2 ) );
+}
+
+// The number of frames a client's message grants (0 if it isn't a credit message)
+inline uint32_t ReadCredit( char const* message, size_t length )
+{
+    if ( length == 0 )
+    {
+        return 1;
+    }
+    return length == c_creditSize ? uint32_t( ReadLittleEndian( message, c_creditSize ) ) : 0;
+}
+
+}  // namespace internal
+}  // namespace DSPatchables
+}  // namespace DSPatch
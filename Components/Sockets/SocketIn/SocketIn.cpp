@@ -18,126 +18,611 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 ******************************************************************************/
 
 #include <Constants.h>
+#include <RingBuffer.h>
+#include <SocketFrame.h>
 #include <SocketIn.h>
+#include <SocketWakeup.h>
 
 extern "C"
 {
 #include <mongoose.h>
 }
 
-static void fn( mg_connection* c, int ev, void* ev_data, void* data )
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+using namespace DSPatch;
+using namespace DSPatchables;
+
+static void fn( mg_connection* c, int ev, void* ev_data, void* data );
+
+namespace DSPatch
+{
+namespace DSPatchables
+{
+namespace internal
 {
-    auto buffer = (std::vector<short>*)data;
-    auto wm = static_cast<mg_ws_message*>( ev_data );
 
-    if ( ev == MG_EV_ERROR )
+using Block = std::vector<std::vector<short>>;  // a buffer per channel (empty for a channel with none this block)
+
+struct Message
+{
+    FrameHeader header;
+    std::chrono::steady_clock::time_point arrival;
+    Block channels;
+};
+
+// (for a single channel: the buffers grow to fit more the first time round)
+inline void PreallocateBlock( Block& block )
+{
+    block.resize( 1 );
+    block[0].reserve( c_bufferSize );
+}
+
+inline size_t FrameCount( Block const& block )
+{
+    size_t frameCount = 0;
+    for ( auto const& channel : block )
     {
-        LOG( LL_ERROR, ( "%p %s", c->fd, static_cast<char*>( ev_data ) ) );
+        frameCount = std::max( frameCount, channel.size() );
     }
-    else if ( ev == MG_EV_WS_OPEN )
+    return frameCount;
+}
+
+// Holds received blocks in sequence order and plays them out just far enough behind the newest to ride out the
+// arrival jitter (c_jitterPercentile of it, over the last c_jitterWindow blocks). A block that isn't there when
+// its turn comes is concealed. Process_() thread only, apart from the stats.
+class JitterBuffer
+{
+public:
+    using Concealment = DSPatchables::SocketIn::Concealment;
+
+    JitterBuffer()
     {
-        *buffer = { 0 };
+        slots.resize( c_jitterCapacity );
+        for ( auto& slot : slots )
+        {
+            PreallocateBlock( slot.channels );
+        }
+        PreallocateBlock( lastBlock );
+        transits.resize( c_jitterWindow );
+        sortedTransits.resize( c_jitterWindow );
     }
-    else if ( ev == MG_EV_CLOSE )
+
+    // Take a received block (trading buffers with the message rather than copying it)
+    void Insert( Message& message )
     {
-        *buffer = {};
+        if ( !started )
+        {
+            Restart( message.header.sequence );
+        }
+
+        auto ahead = int32_t( message.header.sequence - nextSequence );
+        if ( ahead < 0 && ahead >= -c_jitterCapacity )
+        {
+            ++latePackets;
+            return;
+        }
+        if ( ahead < 0 || ahead >= c_jitterCapacity )
+        {
+            // way out of range: the sender restarted (or we stalled for a whole buffer's worth), so start over
+            Restart( message.header.sequence );
+        }
+
+        auto& slot = slots[message.header.sequence % c_jitterCapacity];
+        std::swap( slot.channels, message.channels );
+        slot.sequence = message.header.sequence;
+        slot.filled = true;
+
+        if ( int32_t( message.header.sequence - newestSequence ) > 0 )
+        {
+            newestSequence = message.header.sequence;
+        }
+
+        UpdateTargetDepth( message.header.timestampUs, FrameCount( slot.channels ), message.arrival );
     }
-    else if ( ev == MG_EV_WS_MSG )
+
+    // Produce the next block to output (false while still filling up to the target depth)
+    bool Play( Block& out )
     {
-        if ( wm->data.len != 0 )
+        if ( !started )
+        {
+            return false;
+        }
+
+        auto depth = Depth();
+        depthStat = depth;
+        if ( !playing )
+        {
+            if ( depth < targetDepth )
+            {
+                return false;
+            }
+            playing = true;
+        }
+
+        // skip straight over lost blocks as long as enough are buffered behind them (rather than concealing each)
+        while ( !Filled( nextSequence ) && depth > targetDepth )
         {
-            auto short_data = reinterpret_cast<const short*>( wm->data.ptr );
+            ++nextSequence;
+            --depth;
+            fadeIn = true;
+        }
+
+        auto& slot = slots[nextSequence % c_jitterCapacity];
+        if ( Filled( nextSequence ) )
+        {
+            std::swap( out, slot.channels );
+            slot.filled = false;
+            ++nextSequence;
+
+            if ( fadeIn )
+            {
+                FadeIn( out );
+                fadeIn = false;
+            }
+            concealedBlocks = 0;
 
-            *buffer = {};
-            for ( size_t i = 0; i < wm->data.len / 2; ++i )
+            lastBlock.resize( out.size() );
+            for ( size_t i = 0; i < out.size(); ++i )
             {
-                buffer->push_back( short_data[i] );
+                lastBlock[i].assign( out[i].begin(), out[i].end() );
             }
         }
         else
         {
-            *buffer = { 0 };
+            Conceal( out );
+
+            // if later blocks are already here, this one is lost (or too late to wait for), so move on. Otherwise
+            // hold our place: when it does turn up it plays a block later, and the buffer has grown by a block.
+            if ( depth > 0 )
+            {
+                ++nextSequence;
+            }
         }
+
+        // if more than the target depth stayed buffered for a whole window, drop the excess to bring the latency down
+        lowWater = std::min( lowWater, depth );
+        if ( ++playCount == c_jitterWindow )
+        {
+            for ( ; lowWater > targetDepth; --lowWater )
+            {
+                slots[nextSequence % c_jitterCapacity].filled = false;
+                ++nextSequence;
+                fadeIn = true;
+            }
+            playCount = 0;
+            lowWater = UINT_MAX;
+        }
+
+        return true;
     }
-}
 
-using namespace DSPatch;
-using namespace DSPatchables;
+    std::atomic<Concealment> concealment = Concealment::Repeat;
 
-namespace DSPatch
-{
-namespace DSPatchables
-{
-namespace internal
-{
+    std::atomic<unsigned int> depthStat = 0;
+    std::atomic<unsigned int> targetDepthStat = 0;
+    std::atomic<uint64_t> latePackets = 0;
+    std::atomic<uint64_t> concealedFrames = 0;
+
+private:
+    struct Slot
+    {
+        uint32_t sequence = 0;
+        bool filled = false;
+        Block channels;
+    };
+
+    void Restart( uint32_t sequence )
+    {
+        for ( auto& slot : slots )
+        {
+            slot.filled = false;
+        }
+        started = true;
+        playing = false;
+        nextSequence = sequence;
+        newestSequence = sequence;
+        transitCount = 0;
+        playCount = 0;
+        lowWater = UINT_MAX;
+    }
+
+    bool Filled( uint32_t sequence ) const
+    {
+        auto& slot = slots[sequence % c_jitterCapacity];
+        return slot.filled && slot.sequence == sequence;
+    }
+
+    unsigned int Depth() const
+    {
+        auto depth = int32_t( newestSequence + 1 - nextSequence );
+        return depth > 0 ? depth : 0;
+    }
+
+    // Track each block's transit time (arrival time less the sender's timestamp, so it includes an unknown clock
+    // offset) and aim to hold enough blocks to cover the spread between the fastest transit and the
+    // c_jitterPercentile slowest
+    void UpdateTargetDepth( uint64_t timestampUs, size_t frameCount, std::chrono::steady_clock::time_point arrival )
+    {
+        if ( frameCount == 0 )
+        {
+            return;
+        }
+
+        double blockUs = frameCount * 1000000.0 / c_sampleRate;
+        auto arrivalUs = std::chrono::duration_cast<std::chrono::microseconds>( arrival.time_since_epoch() ).count();
+        transits[transitCount++ % c_jitterWindow] = double( int64_t( arrivalUs - timestampUs ) );
+
+        auto end = sortedTransits.begin() + std::min<size_t>( transitCount, c_jitterWindow );
+        std::copy( transits.begin(), transits.begin() + ( end - sortedTransits.begin() ), sortedTransits.begin() );
+        auto fastest = *std::min_element( sortedTransits.begin(), end );
+        auto nth = sortedTransits.begin() + size_t( c_jitterPercentile * ( end - sortedTransits.begin() - 1 ) );
+        std::nth_element( sortedTransits.begin(), nth, end );
+
+        targetDepth = std::min( 1 + (unsigned int)std::ceil( ( *nth - fastest ) / blockUs ), c_jitterCapacity / 2u );
+        targetDepthStat = targetDepth;
+    }
+
+    void Conceal( Block& out )
+    {
+        // fade the last block received out over one block (Fade) or over c_concealRepeatBlocks repeats (Repeat)
+        float fadeBlocks = concealment == Concealment::Fade ? 1.0f : (float)c_concealRepeatBlocks;
+        float from = std::max( 0.0f, 1.0f - concealedBlocks / fadeBlocks );
+        float to = std::max( 0.0f, 1.0f - ( concealedBlocks + 1 ) / fadeBlocks );
+
+        out.resize( lastBlock.size() );
+        for ( size_t c = 0; c < out.size(); ++c )
+        {
+            auto& channel = out[c];
+            channel.resize( lastBlock[c].size() );
+            for ( size_t i = 0; i < channel.size(); ++i )
+            {
+                channel[i] = short( lastBlock[c][i] * ( from + ( to - from ) * i / channel.size() ) );
+            }
+        }
+
+        ++concealedBlocks;
+        concealedFrames += FrameCount( out );
+        fadeIn = true;
+    }
+
+    // Ramp in the first block after a concealed or dropped one, so it doesn't click in
+    void FadeIn( Block& out )
+    {
+        for ( auto& channel : out )
+        {
+            auto frameCount = std::min( channel.size(), (size_t)c_concealFadeInFrames );
+            for ( size_t i = 0; i < frameCount; ++i )
+            {
+                channel[i] = short( channel[i] * float( i ) / frameCount );
+            }
+        }
+    }
+
+    std::vector<Slot> slots;  // indexed by sequence number % c_jitterCapacity
+    bool started = false;
+    bool playing = false;
+    uint32_t nextSequence = 0;  // the next block to play
+    uint32_t newestSequence = 0;
+    unsigned int targetDepth = 1;
+
+    std::vector<double> transits;  // the last c_jitterWindow transit times (us)
+    std::vector<double> sortedTransits;
+    size_t transitCount = 0;
+
+    unsigned int playCount = 0;
+    unsigned int lowWater = UINT_MAX;  // least depth seen over the last playCount blocks
+
+    Block lastBlock;  // (empty until the first block has played: concealing before then outputs nothing)
+    unsigned int concealedBlocks = 0;  // in a row
+    bool fadeIn = false;
+};
 
 class SocketIn
 {
 public:
     SocketIn()
     {
+        // preallocate the receive queue so that neither thread allocates once messages are flowing
+        received.Reset( c_socketQueueDepth );
+        for ( auto& message : received.Slots() )
+        {
+            PreallocateBlock( message.channels );
+        }
+        PreallocateBlock( output );
+
         mg_mgr_init( &mgr );
-        c = mg_ws_connect( &mgr, "localhost:8000", fn, &buffer, nullptr );
+        wakeup.Attach( mgr );
+        Connect();
+
+        networkThread = std::thread( &SocketIn::RunNetwork, this );
     }
 
     ~SocketIn()
     {
+        stopNetwork = true;
+        networkThread.join();
+
         mg_mgr_free( &mgr );
     }
 
+    // An empty url connects to the default port on localhost, and a bare port to that port on localhost
+    static std::string Address( std::string const& url )
+    {
+        if ( url.empty() )
+        {
+            return "localhost:" + std::to_string( c_socketDefaultPort );
+        }
+        else if ( url.find( ":" ) == std::string::npos )
+        {
+            return "localhost:" + url;
+        }
+        return url;
+    }
+
+    void Connect()
+    {
+        lastConnect = std::chrono::steady_clock::now();
+        c = mg_ws_connect( &mgr, url.c_str(), fn, this, nullptr );
+    }
+
+    // The Mongoose event loop runs here, off the graph thread. Process_() only counts requests and pops received
+    // buffers (waking us to grant credit for the room), so a tick never waits on the network.
+    void RunNetwork()
+    {
+        while ( !stopNetwork )
+        {
+            if ( urlChanged.exchange( false ) )
+            {
+                std::lock_guard<std::mutex> lock( urlMutex );
+                url = newUrl;
+                connected = false;
+                mg_mgr_free( &mgr );
+                mg_mgr_init( &mgr );
+                wakeup.Attach( mgr );
+                Connect();
+            }
+
+            // keep the connection up: reconnect (at most once a second) whenever it drops
+            if ( !c && std::chrono::steady_clock::now() - lastConnect >= std::chrono::milliseconds( c_reconnectIntervalMs ) )
+            {
+                Connect();
+            }
+
+            // the server streams us blocks as long as we have credit with it: keep granting it as much as the receive
+            // queue has room for (topping it up a few blocks at a time)
+            auto room = received.Capacity() - received.Size();
+            if ( connected && room > credits && ( credits == 0 || room - credits >= received.Capacity() / 4 ) )
+            {
+                char grant[c_creditSize];
+                WriteLittleEndian( grant, room - credits, c_creditSize );
+                mg_ws_send( c, grant, c_creditSize, WEBSOCKET_OP_BINARY );
+                credits = room;
+            }
+
+            mg_mgr_poll( &mgr, c_socketPollIntervalMs );
+        }
+    }
+
+    // network thread only
     mg_mgr mgr;
-    mg_connection* c;
-    std::vector<short> buffer;
-    std::string url;
+    mg_connection* c = nullptr;  // (nullptr once closed, until reconnected)
+    std::string url = Address( "" );
+    std::chrono::steady_clock::time_point lastConnect;
+    bool connected = false;
+    size_t credits = 0;  // blocks the server may still send us
+
+    std::thread networkThread;
+    std::atomic<bool> stopNetwork = false;
+
+    std::mutex urlMutex;
+    std::string newUrl = Address( "" );  // (the address connected to, or about to be)
+    std::atomic<bool> urlChanged = false;
+
+    // the network thread copies each message straight into a preallocated slot, which Process_() then trades into
+    // the jitter buffer, and from there with the output signal's buffer (so once the first messages have sized
+    // them, the buffers just swap around)
+    RingBuffer<Message> received;
+    SocketWakeup wakeup;
+    JitterBuffer jitter;
+    Block output;
+
+    std::mutex processMutex;
+    std::atomic<unsigned int> channelCount = 0;
 };
 
 }  // namespace internal
 }  // namespace DSPatchables
 }  // namespace DSPatch
 
-SocketIn::SocketIn()
+static void fn( mg_connection* c, int ev, void* ev_data, void* data )
+{
+    auto p = static_cast<internal::SocketIn*>( data );
+    auto wm = static_cast<mg_ws_message*>( ev_data );
+
+    if ( ev == MG_EV_ERROR )
+    {
+        LOG( LL_ERROR, ( "%p %s", c->fd, static_cast<char*>( ev_data ) ) );
+    }
+    else if ( ev == MG_EV_WS_OPEN )
+    {
+        p->connected = true;
+        p->credits = 0;
+    }
+    else if ( ev == MG_EV_CLOSE )
+    {
+        if ( c == p->c )
+        {
+            p->connected = false;
+            p->c = nullptr;
+        }
+    }
+    else if ( ev == MG_EV_WS_MSG )
+    {
+        internal::FrameHeader header;
+        if ( !internal::ReadFrameHeader( wm->data.ptr, wm->data.len, header ) )
+        {
+            return;
+        }
+
+        size_t sampleCount = 0;
+        for ( size_t i = 0; i < header.channelCount; ++i )
+        {
+            sampleCount += internal::ReadChannelFrameCount( wm->data.ptr, i );
+        }
+        if ( wm->data.len != internal::FrameDataOffset( header.channelCount ) + sampleCount * sizeof( short ) )
+        {
+            return;  // malformed
+        }
+
+        if ( p->credits != 0 )
+        {
+            --p->credits;
+        }
+
+        // one copy of each channel's samples (resizing within the slot's existing capacity). Credit keeps the server
+        // from overrunning the queue, but should it anyway the block is dropped (and the jitter buffer conceals the gap).
+        auto message = p->received.WriteSlot();
+        if ( message )
+        {
+            message->header = header;
+            message->arrival = std::chrono::steady_clock::now();
+            message->channels.resize( header.channelCount );
+
+            auto data = wm->data.ptr + internal::FrameDataOffset( header.channelCount );
+            for ( size_t i = 0; i < header.channelCount; ++i )
+            {
+                auto& channel = message->channels[i];
+                channel.resize( internal::ReadChannelFrameCount( wm->data.ptr, i ) );
+                memcpy( channel.data(), data, channel.size() * sizeof( short ) );
+                data += channel.size() * sizeof( short );
+            }
+
+            p->received.Push();
+        }
+    }
+}
+
+SocketIn::SocketIn( unsigned int channelCount )
     : p( new internal::SocketIn )
 {
     SetInputCount_( 1, { "url" } );
-    SetOutputCount_( 1, { "in" } );
+    SetChannelCount( channelCount );
+}
+
+void SocketIn::SetChannelCount( unsigned int channelCount )
+{
+    std::lock_guard<std::mutex> lock( p->processMutex );
+
+    // one output per channel ("in", or "in1" to "inN")
+    std::vector<std::string> names;
+    for ( unsigned int i = 0; i < channelCount; ++i )
+    {
+        names.emplace_back( channelCount == 1 ? "in" : "in" + std::to_string( i + 1 ) );
+    }
+
+    p->channelCount = channelCount;
+    SetOutputCount_( channelCount, names );
+}
+
+unsigned int SocketIn::GetChannelCount() const
+{
+    return p->channelCount;
 }
 
 void SocketIn::SetUrl( std::string const& newUrl )
 {
-    if ( newUrl != p->url )
+    auto address = internal::SocketIn::Address( newUrl );
+
+    // (only reconnect to an address we aren't already connected to)
+    std::lock_guard<std::mutex> lock( p->urlMutex );
+    if ( address != p->newUrl )
     {
-        p->url = newUrl;
-        p->buffer = {};
-        mg_mgr_free( &p->mgr );
-        mg_mgr_init( &p->mgr );
-        if ( p->url.find( ":" ) == std::string::npos )
-        {
-            p->c = mg_ws_connect( &p->mgr, ( "localhost:" + p->url ).c_str(), fn, &p->buffer, nullptr );
-        }
-        else
-        {
-            p->c = mg_ws_connect( &p->mgr, p->url.c_str(), fn, &p->buffer, nullptr );
-        }
+        p->newUrl = address;
+        p->urlChanged = true;
     }
 }
 
+void SocketIn::SetConcealment( Concealment concealment )
+{
+    p->jitter.concealment = concealment;
+}
+
+SocketIn::Concealment SocketIn::GetConcealment() const
+{
+    return p->jitter.concealment;
+}
+
+SocketIn::JitterStats SocketIn::GetJitterStats() const
+{
+    JitterStats stats;
+    stats.depth = p->jitter.depthStat;
+    stats.targetDepth = p->jitter.targetDepthStat;
+    stats.latePackets = p->jitter.latePackets;
+    stats.concealedFrames = p->jitter.concealedFrames;
+    return stats;
+}
+
+void SocketIn::ResetJitterStats()
+{
+    p->jitter.latePackets = 0;
+    p->jitter.concealedFrames = 0;
+}
+
 void SocketIn::Process_( SignalBus& inputs, SignalBus& outputs )
 {
+    std::lock_guard<std::mutex> lock( p->processMutex );
+
     auto url = inputs.GetValue<std::string>( 0 );
     if ( url )
     {
         SetUrl( *url );
     }
 
-    if ( !p->buffer.empty() )
+    // take in everything that arrived since the last tick (freeing room the network thread then grants credit for)
+    internal::Message* message;
+    bool freed = false;
+    while ( ( message = p->received.ReadSlot() ) )
+    {
+        p->jitter.Insert( *message );
+        p->received.Pop();
+        freed = true;
+    }
+    if ( freed )
     {
-        mg_ws_send( p->c, nullptr, 0, WEBSOCKET_OP_BINARY );
+        p->wakeup.Wake();
     }
 
-    mg_mgr_poll( &p->mgr, c_doublePeriod );
+    if ( !p->jitter.Play( p->output ) )
+    {
+        return;
+    }
 
-    if ( p->buffer.size() > 1 )
+    // output each channel the sender had a buffer for (channels beyond our outputs are ignored)
+    auto channelCount = std::min<size_t>( p->output.size(), p->channelCount );
+    for ( size_t i = 0; i < channelCount; ++i )
     {
-        outputs.SetValue( 0, p->buffer );
+        auto& channel = p->output[i];
+        if ( channel.empty() )
+        {
+            continue;
+        }
+
+        // trade the block for the buffer last output (when handed back to us) rather than copying it
+        auto buffer = outputs.GetValue<std::vector<short>>( (int)i );
+        if ( buffer )
+        {
+            std::swap( *buffer, channel );
+        }
+        else
+        {
+            outputs.SetValue( (int)i, channel );
+        }
     }
 }
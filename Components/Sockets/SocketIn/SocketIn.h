@@ -21,6 +21,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include <DSPatch.h>
 
+#include <cstdint>
+
 namespace DSPatch
 {
 namespace DSPatchables
@@ -34,10 +36,36 @@ class SocketIn;
 class DLLEXPORT SocketIn final : public Component
 {
 public:
-    SocketIn();
+    // How a block that hasn't arrived in time is filled in
+    enum class Concealment
+    {
+        Repeat,  // repeat the last block received, fading it out over a few blocks
+        Fade     // fade the last block received out to silence within one block
+    };
+
+    struct JitterStats
+    {
+        unsigned int depth = 0;        // blocks currently held in the jitter buffer
+        unsigned int targetDepth = 0;  // blocks the jitter buffer aims to hold (adapts to the arrival jitter)
+        uint64_t latePackets = 0;      // blocks that arrived after their turn to play had passed
+        uint64_t concealedFrames = 0;  // frames filled in for blocks that hadn't arrived
+    };
+
+    explicit SocketIn( unsigned int channelCount = 1 );
 
     void SetUrl( std::string const& newUrl );
 
+    // Outputs for the first channelCount channels of the stream (a SocketOut sends all of its channels over the one
+    // connection)
+    void SetChannelCount( unsigned int channelCount );
+    unsigned int GetChannelCount() const;
+
+    void SetConcealment( Concealment concealment );
+    Concealment GetConcealment() const;
+
+    JitterStats GetJitterStats() const;
+    void ResetJitterStats();
+
 protected:
     virtual void Process_( SignalBus& inputs, SignalBus& outputs ) override;
 
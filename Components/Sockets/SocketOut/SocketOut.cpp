@@ -18,38 +18,24 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 ******************************************************************************/
 
 #include <Constants.h>
+#include <RingBuffer.h>
+#include <SocketFrame.h>
 #include <SocketOut.h>
+#include <SocketWakeup.h>
 
 extern "C"
 {
 #include <mongoose.h>
 }
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <mutex>
 #include <thread>
 
-static void fn( mg_connection* c, int ev, void* ev_data, void* data )
-{
-    auto buffer = (std::vector<short>*)data;
-    auto hm = static_cast<mg_http_message*>( ev_data );
-
-    if ( ev == MG_EV_ERROR )
-    {
-        LOG( LL_ERROR, ( "%p %s", c->fd, static_cast<char*>( ev_data ) ) );
-    }
-    else if ( ev == MG_EV_HTTP_MSG && std::string( hm->message.ptr ).find( "websocket" ) != std::string::npos )
-    {
-        mg_ws_upgrade( c, hm );
-    }
-    else if ( ev == MG_EV_HTTP_MSG )
-    {
-        mg_http_serve_dir( c, hm, HTML_ROOT );
-    }
-    else if ( ev == MG_EV_WS_MSG )
-    {
-        mg_ws_send( c, (const char*)&( *buffer )[0], buffer->size() * 2, WEBSOCKET_OP_BINARY );
-        *buffer = {};
-    }
-}
+static void fn( mg_connection* c, int ev, void* ev_data, void* data );
 
 using namespace DSPatch;
 using namespace DSPatchables;
@@ -61,71 +47,281 @@ namespace DSPatchables
 namespace internal
 {
 
+struct Block
+{
+    FrameHeader header;
+    std::vector<std::vector<short>> channels;  // (empty for a channel that had no buffer this block)
+};
+
+struct Client
+{
+    mg_connection* conn;
+    uint32_t credits;  // frames this client has room for
+};
+
 class SocketOut
 {
 public:
     SocketOut()
     {
+        // preallocate the send queue so that neither thread allocates once buffers are flowing
+        // (for a single channel: Process_() grows the slots if more are added)
+        queue.Reset( c_socketQueueDepth );
+        for ( auto& block : queue.Slots() )
+        {
+            block.channels.resize( 1 );
+            block.channels[0].reserve( c_bufferSize );
+        }
+        frame.reserve( FrameDataOffset( 1 ) + c_bufferSize * sizeof( short ) );
+
         mg_mgr_init( &mgr );
-        c = mg_http_listen( &mgr, "localhost:8000", fn, &buffer );
+        c = mg_http_listen( &mgr, ( "localhost:" + newPort ).c_str(), fn, this );
+        wakeup.Attach( mgr );
+
+        networkThread = std::thread( &SocketOut::RunNetwork, this );
     }
 
     ~SocketOut()
     {
+        stopNetwork = true;
+        networkThread.join();
+
         mg_mgr_free( &mgr );
     }
 
+    // The Mongoose event loop runs here, off the graph thread. Process_() only queues its buffer (and wakes us), so a
+    // tick never waits on the network, and blocks are streamed out as soon as they're queued.
+    void RunNetwork()
+    {
+        while ( !stopNetwork )
+        {
+            if ( portChanged.exchange( false ) )
+            {
+                std::lock_guard<std::mutex> lock( portMutex );
+                clients.clear();
+                mg_mgr_free( &mgr );
+                mg_mgr_init( &mgr );
+                c = mg_http_listen( &mgr, ( "localhost:" + newPort ).c_str(), fn, this );
+                wakeup.Attach( mgr );
+            }
+
+            mg_mgr_poll( &mgr, c_socketPollIntervalMs );
+
+            Serve();
+        }
+    }
+
+    // Stream queued blocks, oldest first, to every client with credit. A block waits in the queue until at least
+    // one client has room for it (clients that don't, miss it: their receivers see a gap in the sequence).
+    void Serve()
+    {
+        bool listening = false;
+        for ( auto conn = mgr.conns; conn; conn = conn->next )
+        {
+            listening |= conn->is_websocket;
+        }
+
+        Block* block;
+        while ( ( block = queue.ReadSlot() ) )
+        {
+            if ( listening )
+            {
+                if ( std::none_of( clients.begin(), clients.end(), []( Client const& client ) { return client.credits != 0; } ) )
+                {
+                    break;
+                }
+
+                // all channels go out together in one frame
+                size_t sampleCount = 0;
+                for ( auto const& channel : block->channels )
+                {
+                    sampleCount += channel.size();
+                }
+                frame.resize( FrameDataOffset( block->channels.size() ) + sampleCount * sizeof( short ) );
+
+                WriteFrameHeader( frame.data(), block->header );
+                auto data = frame.data() + FrameDataOffset( block->channels.size() );
+                for ( size_t i = 0; i < block->channels.size(); ++i )
+                {
+                    auto const& channel = block->channels[i];
+                    WriteChannelFrameCount( frame.data(), i, uint16_t( channel.size() ) );
+                    memcpy( data, channel.data(), channel.size() * sizeof( short ) );
+                    data += channel.size() * sizeof( short );
+                }
+
+                for ( auto& client : clients )
+                {
+                    if ( client.credits != 0 )
+                    {
+                        mg_ws_send( client.conn, frame.data(), frame.size(), WEBSOCKET_OP_BINARY );
+                        --client.credits;
+                    }
+                }
+            }
+
+            // (with nobody listening, drop buffers as they arrive rather than serving a stale queue later)
+            queue.Pop();
+        }
+    }
+
+    // network thread only
     mg_mgr mgr;
     mg_connection* c;
-    std::vector<short> buffer;
-    std::string port;
+    std::vector<Client> clients;  // websocket clients that have granted credit
+    std::vector<char> frame;
+
+    std::thread networkThread;
+    std::atomic<bool> stopNetwork = false;
+
+    std::mutex portMutex;
+    std::string newPort = std::to_string( c_socketDefaultPort );  // (the port listened on, or about to be)
+    std::atomic<bool> portChanged = false;
+
+    // Process_() copies each input buffer into a preallocated slot for the network thread to send
+    RingBuffer<Block> queue;
+    uint32_t sequence = 0;  // (graph thread only)
+    SocketWakeup wakeup;
+
+    std::mutex processMutex;
+    std::atomic<unsigned int> channelCount = 0;
 };
 
 }  // namespace internal
 }  // namespace DSPatchables
 }  // namespace DSPatch
 
-SocketOut::SocketOut()
+static void fn( mg_connection* c, int ev, void* ev_data, void* data )
+{
+    auto p = static_cast<internal::SocketOut*>( data );
+    auto hm = static_cast<mg_http_message*>( ev_data );
+
+    if ( ev == MG_EV_ERROR )
+    {
+        LOG( LL_ERROR, ( "%p %s", c->fd, static_cast<char*>( ev_data ) ) );
+    }
+    else if ( ev == MG_EV_HTTP_MSG && std::string( hm->message.ptr ).find( "websocket" ) != std::string::npos )
+    {
+        mg_ws_upgrade( c, hm );
+    }
+    else if ( ev == MG_EV_HTTP_MSG )
+    {
+        mg_http_serve_dir( c, hm, HTML_ROOT );
+    }
+    else if ( ev == MG_EV_WS_MSG )
+    {
+        // a credit grant: Serve() streams this client up to that many more blocks as they're queued
+        auto wm = static_cast<mg_ws_message*>( ev_data );
+        auto credits = internal::ReadCredit( wm->data.ptr, wm->data.len );
+
+        auto client = std::find_if( p->clients.begin(), p->clients.end(), [c]( internal::Client const& entry ) {
+            return entry.conn == c;
+        } );
+        if ( client == p->clients.end() )
+        {
+            p->clients.push_back( { c, credits } );
+        }
+        else
+        {
+            // (saturating, so that a client granting "as many as possible" more than once doesn't wrap back to few)
+            client->credits += std::min( credits, std::numeric_limits<uint32_t>::max() - client->credits );
+        }
+    }
+    else if ( ev == MG_EV_CLOSE )
+    {
+        p->clients.erase( std::remove_if( p->clients.begin(),
+                                          p->clients.end(),
+                                          [c]( internal::Client const& client ) { return client.conn == c; } ),
+                          p->clients.end() );
+    }
+}
+
+SocketOut::SocketOut( unsigned int channelCount )
     : p( new internal::SocketOut )
 {
-    SetInputCount_( 2, { "out", "port" } );
+    SetChannelCount( channelCount );
 }
 
-void SocketOut::SetPort( std::string const& newPort )
+void SocketOut::SetChannelCount( unsigned int channelCount )
 {
-    if ( newPort != p->port )
+    std::lock_guard<std::mutex> lock( p->processMutex );
+
+    // one input per channel ("out", or "out1" to "outN"), followed by "port"
+    std::vector<std::string> names;
+    for ( unsigned int i = 0; i < channelCount; ++i )
     {
-        p->port = newPort;
-        p->buffer = {};
-        mg_mgr_free( &p->mgr );
-        mg_mgr_init( &p->mgr );
-        p->c = mg_http_listen( &p->mgr, ( "localhost:" + p->port ).c_str(), fn, &p->buffer );
+        names.emplace_back( channelCount == 1 ? "out" : "out" + std::to_string( i + 1 ) );
     }
+    names.emplace_back( "port" );
+
+    p->channelCount = channelCount;
+    SetInputCount_( channelCount + 1, names );
 }
 
-void SocketOut::Process_( SignalBus& inputs, SignalBus& )
+unsigned int SocketOut::GetChannelCount() const
+{
+    return p->channelCount;
+}
+
+void SocketOut::SetPort( std::string const& newPort )
 {
-    auto in = inputs.GetValue<std::vector<short>>( 0 );
-    if ( in )
+    auto port = newPort.empty() ? std::to_string( c_socketDefaultPort ) : newPort;
+
+    // (only restart the listener for a port it isn't already on)
+    std::lock_guard<std::mutex> lock( p->portMutex );
+    if ( port != p->newPort )
     {
-        p->buffer = *in;
+        p->newPort = port;
+        p->portChanged = true;
     }
+}
+
+void SocketOut::Process_( SignalBus& inputs, SignalBus& )
+{
+    std::lock_guard<std::mutex> lock( p->processMutex );
 
-    auto port = inputs.GetValue<std::string>( 1 );
+    auto port = inputs.GetValue<std::string>( p->channelCount );
     if ( port )
     {
         SetPort( *port );
     }
 
-    auto begin = std::chrono::steady_clock::now();
-    decltype( begin ) end;
-    do
+    bool hasInput = false;
+    for ( unsigned int i = 0; i < p->channelCount; ++i )
+    {
+        hasInput |= inputs.GetValue<std::vector<short>>( i ) != nullptr;
+    }
+    if ( !hasInput )
+    {
+        return;
+    }
+
+    // copy into the next free slot (within its existing capacity), or drop the block if the client has fallen a
+    // whole queue behind (its sequence number is used up either way, so the receiver sees the gap)
+    auto block = p->queue.WriteSlot();
+    if ( block )
     {
-        mg_mgr_poll( &p->mgr, c_doublePeriod );
-        if ( p->buffer.empty() )
+        block->header.sequence = p->sequence;
+        block->header.timestampUs =
+            std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+        block->header.channelCount = uint16_t( p->channelCount );
+
+        block->channels.resize( p->channelCount );
+        for ( unsigned int i = 0; i < p->channelCount; ++i )
         {
-            break;
+            auto in = inputs.GetValue<std::vector<short>>( i );
+            if ( in )
+            {
+                // (a frame can only describe up to c_maxChannelFrames per channel: send no more than that)
+                block->channels[i].assign( in->begin(), in->begin() + std::min( in->size(), internal::c_maxChannelFrames ) );
+            }
+            else
+            {
+                block->channels[i].clear();
+            }
         }
-        end = std::chrono::steady_clock::now();
-    } while ( std::chrono::duration_cast<std::chrono::milliseconds>( end - begin ).count() < c_doublePeriod );
+
+        p->queue.Push();
+        p->wakeup.Wake();
+    }
+    ++p->sequence;
 }
@@ -34,10 +34,15 @@ class SocketOut;
 class DLLEXPORT SocketOut final : public Component
 {
 public:
-    SocketOut();
+    explicit SocketOut( unsigned int channelCount = 1 );
 
     void SetPort( std::string const& newPort );
 
+    // All channels are multiplexed over the one connection, a frame per block. The port input follows the
+    // channel inputs.
+    void SetChannelCount( unsigned int channelCount );
+    unsigned int GetChannelCount() const;
+
 protected:
     virtual void Process_( SignalBus& inputs, SignalBus& outputs ) override;
 
@@ -0,0 +1,118 @@
+/******************************************************************************
+Sockets DSPatch Components
+Copyright (c) 2025, Marcus Tomlinson
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+******************************************************************************/
+
+#pragma once
+
+extern "C"
+{
+#include <mongoose.h>
+}
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace DSPatch
+{
+namespace DSPatchables
+{
+namespace internal
+{
+
+// Cuts a network thread's mg_mgr_poll() short from another thread. Mongoose 7.0 has no wakeup call of its own, but
+// the poll waits on all of its connections' sockets: so the event loop holds a loopback UDP socket as one of its
+// connections, and Wake() sends it a byte.
+class SocketWakeup
+{
+public:
+#ifdef _WIN32
+    using Socket = SOCKET;
+#else
+    using Socket = int;
+#endif
+
+    SocketWakeup()
+    {
+        sender = socket( AF_INET, SOCK_DGRAM, 0 );
+
+        // (never block the waking thread, even should the event loop have fallen far behind)
+#ifdef _WIN32
+        u_long nonBlocking = 1;
+        ioctlsocket( sender, FIONBIO, &nonBlocking );
+#else
+        fcntl( sender, F_SETFL, fcntl( sender, F_GETFL, 0 ) | O_NONBLOCK );
+#endif
+    }
+
+    ~SocketWakeup()
+    {
+#ifdef _WIN32
+        closesocket( sender );
+#else
+        close( sender );
+#endif
+    }
+
+    // Network thread: add the receiving end to mgr (again after each mg_mgr_init(), as mg_mgr_free() closes it).
+    // If this fails, the event loop just wakes at its poll interval as before.
+    void Attach( mg_mgr& mgr )
+    {
+        // (an unconnected UDP "client" is only a socket that Mongoose reads from: bind it to a loopback port)
+        auto receiver = mg_connect( &mgr, "udp://127.0.0.1:0", &SocketWakeup::Drain, nullptr );
+        if ( !receiver )
+        {
+            return;
+        }
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+        socklen_t length = sizeof( address );
+
+        auto fd = static_cast<Socket>( reinterpret_cast<intptr_t>( receiver->fd ) );
+        if ( bind( fd, reinterpret_cast<sockaddr*>( &address ), sizeof( address ) ) == 0 &&
+             getsockname( fd, reinterpret_cast<sockaddr*>( &address ), &length ) == 0 )
+        {
+            connect( sender, reinterpret_cast<sockaddr*>( &address ), sizeof( address ) );
+        }
+    }
+
+    // Any thread: a single non-blocking send (wakeups that find the event loop already awake are harmless)
+    void Wake()
+    {
+        const char byte = 0;
+        send( sender, &byte, 1, 0 );
+    }
+
+private:
+    static void Drain( mg_connection* c, int ev, void*, void* )
+    {
+        if ( ev == MG_EV_READ )
+        {
+            c->recv.len = 0;  // (the byte itself means nothing)
+        }
+    }
+
+    Socket sender;
+};
+
+}  // namespace internal
+}  // namespace DSPatchables
+}  // namespace DSPatch
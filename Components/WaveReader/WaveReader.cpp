@@ -29,9 +29,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <Constants.h>
 #include <WaveReader.h>
 
+#include <algorithm>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <mutex>
+#include <unordered_map>
 
 using namespace DSPatch;
 using namespace DSPatchables;
@@ -43,13 +48,11 @@ namespace DSPatchables
 namespace internal
 {
 
-class WaveReader
+class WaveFile
 {
 public:
-    explicit WaveReader( std::string const& fileName )
+    explicit WaveFile( std::string const& fileName )
     {
-        streamData.resize( bufferSize );
-
         std::ifstream inFile( fileName, std::ios::binary | std::ios::in );
 
         if ( inFile.bad() )
@@ -163,12 +166,104 @@ public:
         unsigned short extraDataSize = 0;  // Bytes of extra data appended to this struct
     };
 
-    size_t bufferSize = c_bufferSize;
-    int sampleIndex = 0;
-
     WaveFormat waveFormat;
     std::vector<short> waveData;
-    std::vector<short> streamData;
+};
+
+class WaveCache
+{
+public:
+    static WaveCache& Instance()
+    {
+        static WaveCache cache;
+        return cache;
+    }
+
+    std::shared_ptr<WaveFile const> Load( std::string const& fileName );
+
+    void SetBudget( size_t newBudget )
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+
+        budget = newBudget;
+        Evict();
+    }
+
+    size_t GetBudget()
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        return budget;
+    }
+
+    size_t GetSize()
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        return size;
+    }
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<WaveFile const> file;
+        std::filesystem::file_time_type modified;
+        std::list<std::string>::iterator lruIt;
+    };
+
+    void Evict();
+
+    void Erase( std::unordered_map<std::string, Entry>::iterator it )
+    {
+        size -= it->second.file->waveData.size() * sizeof( short );
+        lru.erase( it->second.lruIt );
+        entries.erase( it );
+    }
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru;  // most recently used first
+    size_t budget = c_waveCacheBudget;
+    size_t size = 0;
+};
+
+class WaveReader
+{
+public:
+    explicit WaveReader( std::string const& fileName )
+        : file( WaveCache::Instance().Load( fileName ) )
+        , waveFormat( file->waveFormat )
+        , waveData( file->waveData )
+    {
+        if ( waveFormat.channelCount != 0 )
+        {
+            frameCount = waveData.size() / waveFormat.channelCount;
+        }
+        loopOut = frameCount;
+
+        streamData.resize( waveFormat.channelCount, std::vector<short>( bufferSize ) );
+    }
+
+    size_t Read( size_t index, size_t end );
+
+    size_t bufferSize = c_bufferSize;
+    size_t frameCount = 0;
+
+    // playback position and loop region, in frames
+    size_t position = 0;
+    size_t loopIn = 0;
+    size_t loopOut = 0;
+    bool looping = true;
+    bool finished = false;
+
+    // decoded file data, shared with other readers of the same file
+    std::shared_ptr<WaveFile const> file;
+    WaveFile::WaveFormat const& waveFormat;
+    std::vector<short> const& waveData;
+
+    std::vector<std::vector<short>> streamData;
+
+    std::mutex processMutex;
+
+    std::function<void()> callback = []() {};
 };
 
 }  // namespace internal
@@ -181,26 +276,227 @@ WaveReader::WaveReader( std::string const& fileName )
     SetOutputCount_( p->waveFormat.channelCount );
 }
 
+void WaveReader::SetCacheBudget( size_t bytes )
+{
+    internal::WaveCache::Instance().SetBudget( bytes );
+}
+
+size_t WaveReader::GetCacheBudget()
+{
+    return internal::WaveCache::Instance().GetBudget();
+}
+
+size_t WaveReader::GetCacheSize()
+{
+    return internal::WaveCache::Instance().GetSize();
+}
+
+size_t WaveReader::GetFrameCount() const
+{
+    return p->frameCount;
+}
+
+void WaveReader::SetPosition( size_t frame )
+{
+    std::lock_guard<std::mutex> lock( p->processMutex );
+
+    p->position = std::min( frame, p->frameCount );
+    p->finished = false;
+}
+
+size_t WaveReader::GetPosition() const
+{
+    std::lock_guard<std::mutex> lock( p->processMutex );
+    return p->position;
+}
+
+bool WaveReader::SetLoopPoints( size_t loopIn, size_t loopOut )
+{
+    if ( loopIn >= loopOut || loopOut > p->frameCount )
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock( p->processMutex );
+
+    p->loopIn = loopIn;
+    p->loopOut = loopOut;
+    return true;
+}
+
+size_t WaveReader::GetLoopIn() const
+{
+    std::lock_guard<std::mutex> lock( p->processMutex );
+    return p->loopIn;
+}
+
+size_t WaveReader::GetLoopOut() const
+{
+    std::lock_guard<std::mutex> lock( p->processMutex );
+    return p->loopOut;
+}
+
+void WaveReader::SetLooping( bool looping )
+{
+    std::lock_guard<std::mutex> lock( p->processMutex );
+
+    p->looping = looping;
+    p->finished = false;
+}
+
+bool WaveReader::IsLooping() const
+{
+    std::lock_guard<std::mutex> lock( p->processMutex );
+    return p->looping;
+}
+
+bool WaveReader::IsFinished() const
+{
+    std::lock_guard<std::mutex> lock( p->processMutex );
+    return p->finished;
+}
+
+void WaveReader::SetFinishedCallback( std::function<void()> const& callback )
+{
+    std::lock_guard<std::mutex> lock( p->processMutex );
+    p->callback = callback;
+}
+
 void WaveReader::Process_( SignalBus&, SignalBus& outputs )
 {
-    if ( p->waveData.size() <= p->bufferSize )
+    std::unique_lock<std::mutex> lock( p->processMutex );
+
+    if ( p->frameCount == 0 || p->finished )
     {
         return;
     }
 
-    size_t waveBufferSize = p->bufferSize * p->waveFormat.channelCount;
+    // fill the stream buffers, wrapping at the loop out point when looping
+    size_t index = 0;
+    while ( index < p->bufferSize )
+    {
+        // once past the loop out point (e.g. after a seek), play on to the end of the file
+        size_t end = p->looping && p->position <= p->loopOut ? p->loopOut : p->frameCount;
+        if ( p->position >= end )
+        {
+            if ( !p->looping )
+            {
+                break;
+            }
+            p->position = p->loopIn;
+            continue;
+        }
+
+        index += p->Read( index, end );
+    }
+
+    // in one-shot mode, pad the final buffer with silence
+    if ( index < p->bufferSize )
+    {
+        for ( auto& stream : p->streamData )
+        {
+            std::fill( stream.begin() + index, stream.end(), 0 );
+        }
+    }
+
+    if ( !p->looping && p->position >= p->frameCount )
+    {
+        p->finished = true;
+    }
 
     for ( auto ch = 0; ch < p->waveFormat.channelCount; ++ch )
     {
-        int index = 0;
-        for ( size_t i = ch; i < waveBufferSize; i += p->waveFormat.channelCount )
+        outputs.SetValue( ch, p->streamData[ch] );
+    }
+
+    if ( p->finished )
+    {
+        // call back without the lock held, so that the callback can seek, loop or query this reader
+        auto callback = p->callback;
+        lock.unlock();
+        callback();
+    }
+}
+
+size_t DSPatchables::internal::WaveReader::Read( size_t index, size_t end )
+{
+    size_t count = std::min( bufferSize - index, end - position );
+
+    const size_t channelCount = waveFormat.channelCount;
+    for ( size_t ch = 0; ch < channelCount; ++ch )
+    {
+        const short* in = &waveData[position * channelCount + ch];
+        short* out = &streamData[ch][index];
+        for ( size_t i = 0; i < count; ++i, in += channelCount )
         {
-            p->streamData[index++] = p->waveData[p->sampleIndex + i];
+            out[i] = *in;
         }
+    }
+
+    position += count;
+    return count;
+}
 
-        outputs.SetValue( ch, p->streamData );
+std::shared_ptr<DSPatchables::internal::WaveFile const> DSPatchables::internal::WaveCache::Load( std::string const& fileName )
+{
+    std::error_code error;
+    auto modified = std::filesystem::last_write_time( fileName, error );
+
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+
+        auto it = entries.find( fileName );
+        if ( it != entries.end() )
+        {
+            if ( !error && it->second.modified == modified )
+            {
+                lru.splice( lru.begin(), lru, it->second.lruIt );  // mark as most recently used
+                return it->second.file;
+            }
+
+            Erase( it );  // file changed on disk since it was cached
+        }
     }
 
-    p->sampleIndex += waveBufferSize;
-    p->sampleIndex %= p->waveData.size() - waveBufferSize;
+    // decode outside the lock so that loading one file doesn't hold up readers of another
+    auto file = std::make_shared<WaveFile const>( fileName );
+    if ( error || file->waveData.empty() )
+    {
+        return file;  // don't cache files that failed to load
+    }
+
+    std::lock_guard<std::mutex> lock( mutex );
+
+    auto it = entries.find( fileName );
+    if ( it != entries.end() && it->second.modified == modified )
+    {
+        return it->second.file;  // another reader loaded this file in the meantime
+    }
+    else if ( it != entries.end() )
+    {
+        Erase( it );
+    }
+
+    lru.push_front( fileName );
+    entries[fileName] = Entry{ file, modified, lru.begin() };
+    size += file->waveData.size() * sizeof( short );
+
+    Evict();
+
+    return file;
+}
+
+void DSPatchables::internal::WaveCache::Evict()
+{
+    // drop least recently used files that no reader currently holds
+    auto it = lru.end();
+    while ( size > budget && it != lru.begin() )
+    {
+        auto entry = entries.find( *--it );
+        if ( entry->second.file.use_count() == 1 )
+        {
+            ++it;  // Erase() invalidates the current element
+            Erase( entry );
+        }
+    }
 }
@@ -30,6 +30,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <DSPatch.h>
 
+#include <functional>
+
 namespace DSPatch
 {
 namespace DSPatchables
@@ -45,6 +47,25 @@ class DLLEXPORT WaveReader final : public Component
 public:
     WaveReader( std::string const& fileName );
 
+    static void SetCacheBudget( size_t bytes );
+    static size_t GetCacheBudget();
+    static size_t GetCacheSize();
+
+    size_t GetFrameCount() const;
+
+    void SetPosition( size_t frame );
+    size_t GetPosition() const;
+
+    bool SetLoopPoints( size_t loopIn, size_t loopOut );
+    size_t GetLoopIn() const;
+    size_t GetLoopOut() const;
+
+    void SetLooping( bool looping );
+    bool IsLooping() const;
+
+    bool IsFinished() const;
+    void SetFinishedCallback( std::function<void()> const& callback );
+
 protected:
     virtual void Process_( SignalBus& inputs, SignalBus& outputs ) override;
 
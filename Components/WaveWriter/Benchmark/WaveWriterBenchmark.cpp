@@ -0,0 +1,143 @@
+/******************************************************************************
+WaveWriter Throughput Benchmark
+Copyright (c) 2025, Marcus Tomlinson
+
+BSD 2-Clause License
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Measures the rate WaveWriter can sustain to disk at 2, 8 and 32 channels. Blocks are produced as fast as the
+// write queue accepts them (so nothing is dropped), and the rate counts every byte up to the file being closed.
+//
+// Usage: WaveWriterBenchmark [file] [seconds per run]
+
+#include <WaveWriter.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace DSPatch;
+using namespace DSPatch::DSPatchables;
+
+namespace
+{
+
+// Outputs the same block of noise on every channel, every tick
+class NoiseSource final : public Component
+{
+public:
+    explicit NoiseSource( int channelCount )
+        : block( c_bufferSize )
+    {
+        SetOutputCount_( channelCount );
+
+        std::mt19937 random;
+        std::uniform_int_distribution<int> sample( -32768, 32767 );
+        for ( auto& s : block )
+        {
+            s = static_cast<short>( sample( random ) );
+        }
+    }
+
+protected:
+    virtual void Process_( SignalBus&, SignalBus& outputs ) override
+    {
+        for ( int i = 0; i < GetOutputCount(); ++i )
+        {
+            outputs.SetValue( i, block );
+        }
+    }
+
+private:
+    std::vector<short> block;
+};
+
+void Run( std::string const& fileName, int channelCount, double seconds )
+{
+    uint64_t frameCount = 0;
+    uint64_t overflowCount = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        auto source = std::make_shared<NoiseSource>( channelCount );
+        auto writer = std::make_shared<WaveWriter>( fileName, channelCount, c_bitsPerSample, c_sampleRate );
+
+        auto circuit = std::make_shared<Circuit>();
+        circuit->AddComponent( source );
+        circuit->AddComponent( writer );
+        for ( int i = 0; i < channelCount; ++i )
+        {
+            circuit->ConnectOutToIn( source, i, writer, i );
+        }
+
+        auto end = start + std::chrono::duration<double>( seconds );
+        while ( std::chrono::steady_clock::now() < end )
+        {
+            // keep a slot free so that Process_() never has to drop a block
+            if ( writer->GetQueueDepth() >= c_writeQueueDepth - 1 )
+            {
+                std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+                continue;
+            }
+            circuit->Tick();
+            frameCount += c_bufferSize;
+        }
+
+        overflowCount = writer->GetOverflowCount();
+    }  // (the writer drains its queue and closes the file here)
+    double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    std::remove( fileName.c_str() );
+
+    const double bytes = double( frameCount ) * channelCount * ( c_bitsPerSample / 8 );
+    const double audioSeconds = double( frameCount ) / c_sampleRate;
+
+    std::printf( "%2d channels: %8.1f MB/s, %7.1fx realtime (%.0f s of audio in %.2f s, %llu overflows)\n",
+                 channelCount,
+                 bytes / elapsed / ( 1024 * 1024 ),
+                 audioSeconds / elapsed,
+                 audioSeconds,
+                 elapsed,
+                 static_cast<unsigned long long>( overflowCount ) );
+}
+
+}  // namespace
+
+int main( int argc, char* argv[] )
+{
+    std::string fileName = argc > 1 ? argv[1] : "WaveWriterBenchmark.wav";
+    double seconds = argc > 2 ? std::stod( argv[2] ) : 5.0;
+
+    std::cout << "WaveWriter " << c_bitsPerSample << " bit, " << c_sampleRate << " Hz, " << c_bufferSize
+              << " frame blocks, writing to " << fileName << std::endl;
+
+    for ( int channelCount : { 2, 8, 32 } )
+    {
+        Run( fileName, channelCount, seconds );
+    }
+    return 0;
+}
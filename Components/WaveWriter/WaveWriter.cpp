@@ -26,10 +26,26 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ******************************************************************************/
 
+#include <RingBuffer.h>
 #include <WaveWriter.h>
 
-#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace DSPatch;
 using namespace DSPatchables;
@@ -44,6 +60,77 @@ std::ostream& write_word( std::ostream& outs, Word value, unsigned size = sizeof
     return outs;
 }
 
+static int open_file( std::string const& fileName )
+{
+#ifdef _WIN32
+    return _open( fileName.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE );
+#else
+    return open( fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+#endif
+}
+
+static bool write_file( int fd, char const* data, size_t size )
+{
+    while ( size > 0 )
+    {
+#ifdef _WIN32
+        auto written = _write( fd, data, (unsigned int)size );
+#else
+        auto written = write( fd, data, size );
+#endif
+        if ( written <= 0 )
+        {
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool write_file_at( int fd, uint64_t offset, std::string const& data )
+{
+#ifdef _WIN32
+    // no pwrite() here, so restore the file position after writing
+    auto pos = _lseeki64( fd, 0, SEEK_CUR );
+    bool result = _lseeki64( fd, offset, SEEK_SET ) != -1 && write_file( fd, data.data(), data.size() );
+    _lseeki64( fd, pos, SEEK_SET );
+    return result;
+#else
+    return pwrite( fd, data.data(), data.size(), offset ) == (ssize_t)data.size();
+#endif
+}
+
+static void sync_file( int fd )
+{
+#if defined( _WIN32 )
+    _commit( fd );
+#elif defined( __APPLE__ )
+    fsync( fd );
+#else
+    fdatasync( fd );
+#endif
+}
+
+static void allocate_file( int fd, uint64_t size )
+{
+#ifdef __linux__
+    fallocate( fd, FALLOC_FL_KEEP_SIZE, 0, size );  // (keep the file size, so that the header stays accurate)
+#else
+    (void)fd;
+    (void)size;
+#endif
+}
+
+static void close_file( int fd )
+{
+#ifdef _WIN32
+    _close( fd );
+#else
+    close( fd );
+#endif
+}
+
 namespace DSPatch
 {
 namespace DSPatchables
@@ -54,85 +141,548 @@ namespace internal
 class WaveWriter
 {
 public:
-    WaveWriter( std::string const& fileName, int channelCount )
-        : file( fileName, std::ios::binary )
+    WaveWriter( std::string const& fileName, int channelCount, int bitsPerSample, int sampleRate, bool floatingPoint )
+        : fileName( fileName )
         , dataPos( 0 )
         , channelCount( channelCount )
+        , bitsPerSample( bitsPerSample )
+        , floatingPoint( floatingPoint )
+        , sampleRate( sampleRate )
+        , ins( channelCount )
+        , queue( c_writeQueueDepth )
     {
+        if ( floatingPoint ? bitsPerSample != 32 : ( bitsPerSample % 8 != 0 || bitsPerSample < 8 || bitsPerSample > 32 ) )
+        {
+            std::cerr << bitsPerSample << " bit " << ( floatingPoint ? "float" : "PCM" ) << " output not supported. Using 16 bit PCM."
+                      << std::endl;
+            this->bitsPerSample = 16;
+            this->floatingPoint = false;
+        }
+        blockAlign = this->bitsPerSample / 8 * channelCount;
+
+        for ( auto& slot : queue.Slots() )
+        {
+            slot.reserve( c_bufferSize * blockAlign );
+        }
+        staging.reserve( c_writeBufferSize + c_writeAlignment );
     }
 
-    std::ofstream file;
+    // Per-file state of the disk thread
+    struct Segment
+    {
+        std::string name;
+        int fd = -1;
+        uint64_t filePos = 0;
+        uint64_t frameCount = 0;  // frames handed to this file, including those still staged
+        bool isRf64 = false;
+        bool isPadded = false;
+    };
+
+    void Convert( size_t frameCount, char* out );
+
+    template <typename Sample, typename Converter>
+    void Interleave( size_t frameCount, Sample* out, Converter convert );
+
+    short Dither( short sample );
+
+    void Run();
+    bool Write( size_t size );
+    void UpdateHeader( Segment& segment );
+
+    uint64_t SegmentFrames() const;
+    bool Open( Segment& segment );
+    void Finish();
+    void Rollover();
+
+    std::string fileName;
+    std::string header;
     size_t dataPos;
     int channelCount;
+    int bitsPerSample;
+    bool floatingPoint;
+    int sampleRate;
+    int blockAlign;
+
+    std::vector<std::vector<short>*> ins;
+    std::atomic<bool> dither = true;
+    uint32_t ditherState = 1;
+
+    // tick thread -> disk thread
+    RingBuffer<std::vector<char>> queue;
+
+    // disk thread only
+    std::vector<char> staging;
+    Segment current;
+    Segment next;  // pre-opened when writing in segments
+    int segmentCount = 0;
+    bool writeFailed = false;
+
+    std::thread thread;
+    std::atomic<bool> stopping = false;
+
+    std::atomic<int> syncIntervalMs = 0;
+    std::atomic<int> headerIntervalMs = c_headerIntervalMs;
+    std::atomic<int> segmentDurationS = 0;
+    std::atomic<uint64_t> segmentSize = 0;
+    std::atomic<uint64_t> bytesWritten = 0;
+    std::atomic<uint64_t> overflowCount = 0;
 };
 
 }  // namespace internal
 }  // namespace DSPatchables
 }  // namespace DSPatch
 
-WaveWriter::WaveWriter( std::string const& fileName, int channelCount, int bitsPerSample, int sampleRate )
-    : p( new internal::WaveWriter( fileName, channelCount ) )
+WaveWriter::WaveWriter( std::string const& fileName, int channelCount, int bitsPerSample, int sampleRate, bool floatingPoint )
+    : p( new internal::WaveWriter( fileName, channelCount, bitsPerSample, sampleRate, floatingPoint ) )
 {
     SetInputCount_( channelCount );
 
-    // Write the file headers
-    p->file << "RIFF----WAVEfmt ";                                                // (chunk size to be filled in later)
-    write_word( p->file, 16, 4 );                                                 // no extension data
-    write_word( p->file, 1, 2 );                                                  // PCM - integer samples
-    write_word( p->file, channelCount, 2 );                                       // channel count
-    write_word( p->file, sampleRate, 4 );                                         // samples per second (Hz)
-    write_word( p->file, ( sampleRate * bitsPerSample * channelCount ) / 8, 4 );  // (Sample Rate * BitsPerSample * Channels) / 8
-    write_word( p->file, 2 * channelCount, 2 );  // data block size (size of one integer sample per each channel, in bytes)
-    write_word( p->file, bitsPerSample, 2 );     // number of bits per sample (use a multiple of 8)
+    // Build the file headers (written at the start of every segment)
+    std::ostringstream header;
+    header << "RIFF----WAVE";  // (chunk size to be filled in later)
+    header << "JUNK";          // (space reserved for a ds64 chunk, in case the file grows past 4GB)
+    write_word( header, c_ds64Size, 4 );
+    header << std::string( c_ds64Size, '\0' );
+    header << "fmt ";
+    write_word( header, 16, 4 );                                // no extension data
+    write_word( header, p->floatingPoint ? 3 : 1, 2 );          // PCM - integer samples, or IEEE float samples
+    write_word( header, channelCount, 2 );                      // channel count
+    write_word( header, sampleRate, 4 );                        // samples per second (Hz)
+    write_word( header, sampleRate * p->blockAlign, 4 );        // (Sample Rate * BitsPerSample * Channels) / 8
+    write_word( header, p->blockAlign, 2 );    // data block size (size of one sample per each channel, in bytes)
+    write_word( header, p->bitsPerSample, 2 );  // number of bits per sample (use a multiple of 8)
 
     // Write the data chunk header
-    p->dataPos = (size_t)p->file.tellp();
-    p->file << "data----";  // (chunk size to be filled in later)
+    p->dataPos = (size_t)header.tellp();
+    header << "data----";  // (chunk size to be filled in later)
+
+    p->header = header.str();
+
+    // Open the first file here, and hand all further file access to the disk thread
+    p->Open( p->current );
+    p->thread = std::thread( &internal::WaveWriter::Run, p.get() );
 }
 
 WaveWriter::~WaveWriter()
 {
-    // (We'll need the final file size to fix the chunk sizes above)
-    auto file_length = (size_t)p->file.tellp();
+    // (The disk thread fixes the chunk sizes and closes the file once it has written everything)
+    p->stopping = true;
+    p->thread.join();
+}
 
-    // Fix the data chunk header to contain the data size
-    p->file.seekp( p->dataPos + 4 );
-    write_word( p->file, file_length - p->dataPos + 8 );
+void WaveWriter::SetSyncInterval( int intervalMs )
+{
+    p->syncIntervalMs = intervalMs;
+}
 
-    // Fix the file header to contain the proper RIFF chunk size, which is (file size - 8) bytes
-    p->file.seekp( 0 + 4 );
-    write_word( p->file, file_length - 8, 4 );
+int WaveWriter::GetSyncInterval() const
+{
+    return p->syncIntervalMs;
+}
+
+void WaveWriter::SetHeaderInterval( int intervalMs )
+{
+    p->headerIntervalMs = intervalMs;
+}
+
+int WaveWriter::GetHeaderInterval() const
+{
+    return p->headerIntervalMs;
+}
+
+void WaveWriter::SetSegmentDuration( int seconds )
+{
+    p->segmentDurationS = seconds;
+}
+
+int WaveWriter::GetSegmentDuration() const
+{
+    return p->segmentDurationS;
+}
+
+void WaveWriter::SetSegmentSize( uint64_t bytes )
+{
+    p->segmentSize = bytes;
+}
+
+uint64_t WaveWriter::GetSegmentSize() const
+{
+    return p->segmentSize;
+}
+
+void WaveWriter::SetDither( bool enabled )
+{
+    p->dither = enabled;
+}
+
+bool WaveWriter::GetDither() const
+{
+    return p->dither;
+}
+
+size_t WaveWriter::GetQueueDepth() const
+{
+    return p->queue.Size();
+}
+
+uint64_t WaveWriter::GetBytesWritten() const
+{
+    return p->bytesWritten;
+}
+
+uint64_t WaveWriter::GetOverflowCount() const
+{
+    return p->overflowCount;
 }
 
 void WaveWriter::Process_( SignalBus& inputs, SignalBus& )
 {
-    std::vector<std::vector<short>*> ins;
     for ( int i = 0; i < p->channelCount; ++i )
     {
-        auto in = inputs.GetValue<std::vector<short>>( i );
+        p->ins[i] = inputs.GetValue<std::vector<short>>( i );
 
-        if ( !in )
+        if ( !p->ins[i] )
         {
             return;  // input buffer missing
         }
-
-        ins.emplace_back( in );
     }
 
     for ( int i = 0; i < p->channelCount - 1; ++i )
     {
-        if ( ins[i]->size() != ins[i + 1]->size() )
+        if ( p->ins[i]->size() != p->ins[i + 1]->size() )
         {
             return;  // input buffers are not the same size
         }
     }
 
-    // write input to file
-    for ( size_t j = 0; j < ins[0]->size(); ++j )
+    // interleave input into the next free queue slot for the disk thread to write
+    auto slot = p->queue.WriteSlot();
+    if ( !slot )
+    {
+        ++p->overflowCount;  // the disk thread has fallen behind, drop this buffer
+        return;
+    }
+
+    const size_t frameCount = p->ins[0]->size();
+    slot->resize( frameCount * p->blockAlign );
+    p->Convert( frameCount, slot->data() );
+
+    p->queue.Push();
+}
+
+void DSPatchables::internal::WaveWriter::Convert( size_t frameCount, char* out )
+{
+    struct Int24
+    {
+        char bytes[3];
+    };
+
+    if ( floatingPoint )
+    {
+        Interleave( frameCount, reinterpret_cast<float*>( out ), []( short sample ) { return sample * ( 1.0f / 32768.0f ); } );
+    }
+    else if ( bitsPerSample == 16 )
+    {
+        Interleave( frameCount, reinterpret_cast<short*>( out ), []( short sample ) { return sample; } );
+    }
+    else if ( bitsPerSample == 24 )
+    {
+        Interleave( frameCount, reinterpret_cast<Int24*>( out ), []( short sample ) {
+            return Int24{ { 0, static_cast<char>( sample & 0xFF ), static_cast<char>( sample >> 8 ) } };
+        } );
+    }
+    else if ( bitsPerSample == 32 )
+    {
+        Interleave( frameCount, reinterpret_cast<int32_t*>( out ), []( short sample ) { return sample * 65536; } );
+    }
+    else if ( dither )
+    {
+        // 8 bit PCM is unsigned
+        Interleave( frameCount, reinterpret_cast<unsigned char*>( out ), [this]( short sample ) {
+            return static_cast<unsigned char>( ( Dither( sample ) >> 8 ) + 128 );
+        } );
+    }
+    else
+    {
+        Interleave( frameCount, reinterpret_cast<unsigned char*>( out ), []( short sample ) {
+            return static_cast<unsigned char>( ( sample >> 8 ) + 128 );
+        } );
+    }
+}
+
+template <typename Sample, typename Converter>
+void DSPatchables::internal::WaveWriter::Interleave( size_t frameCount, Sample* out, Converter convert )
+{
+    // unroll the common stereo case so that the compiler can vectorize it
+    if ( channelCount == 2 )
     {
-        for ( int i = 0; i < p->channelCount; ++i )
+        const short* left = ins[0]->data();
+        const short* right = ins[1]->data();
+        for ( size_t j = 0; j < frameCount; ++j )
         {
-            write_word( p->file, ( *ins[i] )[j], 2 );  ///! assumes 16bit
+            out[j * 2] = convert( left[j] );
+            out[j * 2 + 1] = convert( right[j] );
         }
+        return;
     }
+
+    for ( int i = 0; i < channelCount; ++i )
+    {
+        const short* in = ins[i]->data();
+        for ( size_t j = 0; j < frameCount; ++j )
+        {
+            out[j * channelCount + i] = convert( in[j] );
+        }
+    }
+}
+
+short DSPatchables::internal::WaveWriter::Dither( short sample )
+{
+    // TPDF dither: the sum of two uniform random values, spanning +/-1 LSB of the 8 bit output
+    auto random = [this]() {
+        ditherState ^= ditherState << 13;
+        ditherState ^= ditherState >> 17;
+        ditherState ^= ditherState << 5;
+        return static_cast<int>( ditherState & 0xFF );
+    };
+    int dithered = sample + random() - random() + 128;  // (+128 rounds to nearest on the >> 8 that follows)
+
+    return static_cast<short>( std::min( std::max( dithered, -32768 ), 32767 ) );
+}
+
+void DSPatchables::internal::WaveWriter::Run()
+{
+    auto lastSync = std::chrono::steady_clock::now();
+    auto lastHeader = lastSync;
+
+    while ( true )
+    {
+        // anything queued before stopping was set is drained below
+        bool stop = stopping;
+
+        // collect queued buffers into the staging buffer
+        while ( staging.size() < c_writeBufferSize )
+        {
+            auto slot = queue.ReadSlot();
+            if ( !slot )
+            {
+                break;
+            }
+
+            // split the buffer at segment boundaries, so that no frame is lost or repeated across files
+            const uint64_t frameCount = slot->size() / blockAlign;
+            for ( uint64_t offset = 0; offset < frameCount; )
+            {
+                auto limit = SegmentFrames();
+                if ( limit != 0 && current.frameCount >= limit )
+                {
+                    Rollover();
+                    continue;
+                }
+
+                auto count = limit != 0 ? std::min( frameCount - offset, limit - current.frameCount ) : frameCount - offset;
+                staging.insert( staging.end(), slot->begin() + offset * blockAlign, slot->begin() + ( offset + count ) * blockAlign );
+
+                current.frameCount += count;
+                offset += count;
+            }
+
+            queue.Pop();
+        }
+
+        bool drained = queue.Size() == 0;
+
+        if ( stop && drained )
+        {
+            Finish();
+            if ( next.fd != -1 )
+            {
+                // remove the pre-opened segment we didn't get to use
+                close_file( next.fd );
+                std::remove( next.name.c_str() );
+            }
+            break;
+        }
+
+        // write whole alignment blocks only, keeping the remainder for the next write
+        uint64_t alignedEnd = ( current.filePos + staging.size() ) / c_writeAlignment * c_writeAlignment;
+        if ( alignedEnd > current.filePos )
+        {
+            Write( alignedEnd - current.filePos );
+        }
+
+        // have the next segment opened and allocated ahead of time
+        if ( SegmentFrames() != 0 && next.fd == -1 )
+        {
+            Open( next );
+        }
+
+        // keep the chunk sizes up to date so that the file stays readable if we never get to finish it
+        auto headerInterval = headerIntervalMs.load();
+        auto now = std::chrono::steady_clock::now();
+        if ( headerInterval > 0 && now - lastHeader >= std::chrono::milliseconds( headerInterval ) )
+        {
+            UpdateHeader( current );
+            lastHeader = now;
+        }
+
+        auto syncInterval = syncIntervalMs.load();
+        if ( syncInterval > 0 && now - lastSync >= std::chrono::milliseconds( syncInterval ) )
+        {
+            sync_file( current.fd );
+            lastSync = now;
+        }
+
+        if ( drained )
+        {
+            std::this_thread::sleep_for( std::chrono::milliseconds( c_writeIntervalMs ) );
+        }
+    }
+}
+
+bool DSPatchables::internal::WaveWriter::Write( size_t size )
+{
+    if ( size == 0 || current.fd == -1 )
+    {
+        return true;
+    }
+
+    if ( !write_file( current.fd, staging.data(), size ) )
+    {
+        if ( !writeFailed )
+        {
+            std::cerr << "WaveWriter: write failed (" << strerror( errno ) << ")." << std::endl;
+        }
+        writeFailed = true;
+    }
+
+    staging.erase( staging.begin(), staging.begin() + size );
+    current.filePos += size;
+    bytesWritten += size;
+
+    return !writeFailed;
+}
+
+void DSPatchables::internal::WaveWriter::UpdateHeader( Segment& segment )
+{
+    if ( segment.fd == -1 )
+    {
+        return;
+    }
+
+    // Only the data that has actually reached the file is accounted for, in whole frames (writes go out in
+    // alignment blocks, so the file can end part way through a frame until the next write)
+    uint64_t dataSize = ( segment.filePos - dataPos - 8 - ( segment.isPadded ? 1 : 0 ) ) / blockAlign * blockAlign;
+    uint64_t riffSize = dataPos + dataSize + dataSize % 2;  // (up to the end of the data chunk and its pad byte)
+
+    if ( !segment.isRf64 && riffSize > 0xFFFFFFFF )
+    {
+        // Promote to RF64: the real chunk sizes move to the ds64 chunk we reserved space for
+        write_file_at( segment.fd, 0, "RF64" );
+        write_file_at( segment.fd, 12, "ds64" );
+        segment.isRf64 = true;
+    }
+
+    if ( segment.isRf64 )
+    {
+        std::ostringstream ds64;
+        write_word( ds64, riffSize, 8 );               // RIFF size
+        write_word( ds64, dataSize, 8 );               // data size
+        write_word( ds64, dataSize / blockAlign, 8 );  // sample count
+        write_file_at( segment.fd, 20, ds64.str() );
+
+        riffSize = 0xFFFFFFFF;
+        dataSize = 0xFFFFFFFF;
+    }
+
+    // Fix the data chunk header to contain the data size
+    std::ostringstream dataWord;
+    write_word( dataWord, dataSize, 4 );
+    write_file_at( segment.fd, dataPos + 4, dataWord.str() );
+
+    // Fix the file header to contain the proper RIFF chunk size, which is (file size - 8) bytes
+    std::ostringstream riffWord;
+    write_word( riffWord, riffSize, 4 );
+    write_file_at( segment.fd, 4, riffWord.str() );
+}
+
+uint64_t DSPatchables::internal::WaveWriter::SegmentFrames() const
+{
+    // the shorter of the duration and size limits, in frames (0 for no limit)
+    uint64_t limit = (uint64_t)segmentDurationS * sampleRate;
+
+    if ( segmentSize > header.size() + blockAlign )
+    {
+        uint64_t sizeLimit = ( segmentSize - header.size() ) / blockAlign;
+        limit = limit == 0 ? sizeLimit : std::min( limit, sizeLimit );
+    }
+
+    return limit;
+}
+
+bool DSPatchables::internal::WaveWriter::Open( Segment& segment )
+{
+    // the first segment takes the file name as given, later ones are numbered: "name_1.wav", "name_2.wav", ...
+    auto name = fileName;
+    if ( segmentCount != 0 )
+    {
+        auto ext = name.rfind( '.' );
+        ext = ext == std::string::npos || name.find_first_of( "/\\", ext ) != std::string::npos ? name.size() : ext;
+        name.insert( ext, "_" + std::to_string( segmentCount ) );
+    }
+    ++segmentCount;
+
+    segment = Segment();
+    segment.name = name;
+    segment.fd = open_file( name );
+
+    if ( segment.fd == -1 )
+    {
+        std::cerr << "'" << name << "' could not be opened for writing." << std::endl;
+        return false;
+    }
+
+    if ( SegmentFrames() != 0 )
+    {
+        allocate_file( segment.fd, header.size() + SegmentFrames() * blockAlign );
+    }
+
+    // write the header straight away, so that the file is a valid (empty) wave file from the start
+    write_file( segment.fd, header.data(), header.size() );
+    segment.filePos = header.size();
+    UpdateHeader( segment );
+
+    return true;
+}
+
+void DSPatchables::internal::WaveWriter::Finish()
+{
+    // chunks must be an even number of bytes long
+    if ( ( current.filePos + staging.size() ) % 2 != 0 )
+    {
+        staging.push_back( 0 );
+        current.isPadded = true;
+    }
+
+    Write( staging.size() );
+    UpdateHeader( current );
+
+    if ( current.fd != -1 )
+    {
+        close_file( current.fd );
+    }
+    current = Segment();
+}
+
+void DSPatchables::internal::WaveWriter::Rollover()
+{
+    Finish();
+
+    if ( next.fd == -1 )
+    {
+        Open( next );  // (segments were only just enabled, so the next one isn't open yet)
+    }
+
+    current = next;
+    next = Segment();
 }
@@ -31,6 +31,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <Constants.h>
 #include <DSPatch.h>
 
+#include <cstdint>
+
 namespace DSPatch
 {
 namespace DSPatchables
@@ -44,9 +46,27 @@ class WaveWriter;
 class DLLEXPORT WaveWriter final : public Component
 {
 public:
-    WaveWriter( std::string const& fileName, int channelCount, int bitsPerSample, int sampleRate );
+    WaveWriter( std::string const& fileName, int channelCount, int bitsPerSample, int sampleRate, bool floatingPoint = false );
     virtual ~WaveWriter();
 
+    void SetSyncInterval( int intervalMs );
+    int GetSyncInterval() const;
+
+    void SetHeaderInterval( int intervalMs );
+    int GetHeaderInterval() const;
+
+    void SetSegmentDuration( int seconds );
+    int GetSegmentDuration() const;
+    void SetSegmentSize( uint64_t bytes );
+    uint64_t GetSegmentSize() const;
+
+    void SetDither( bool enabled );
+    bool GetDither() const;
+
+    size_t GetQueueDepth() const;
+    uint64_t GetBytesWritten() const;
+    uint64_t GetOverflowCount() const;
+
 protected:
     virtual void Process_( SignalBus& inputs, SignalBus& outputs ) override;
 